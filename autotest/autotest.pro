@@ -0,0 +1,11 @@
+CONFIG += c++11 testcase
+QT += testlib widgets
+
+include(../src/buttonbox.pri)
+
+DESTDIR = ../build
+TARGET = autotestButtonBox
+TEMPLATE = app
+
+SOURCES += \
+    autotestbuttonbox.cpp
@@ -0,0 +1,464 @@
+#include <buttonbox.h>
+#include <flowlayout.h>
+#include <offsetindex.h>
+#include <paletteloader.h>
+#include <prefixindex.h>
+
+#include <QtTest>
+#include <QApplication>
+#include <QBuffer>
+#include <QToolButton>
+
+// Layout item with a settable size hint, hidden when empty, so the flow
+// geometry does not depend on the style or on widget visibility.
+class FixedItem : public QLayoutItem
+{
+public:
+    explicit FixedItem(const QSize& size) : m_size(size) {}
+
+    void setSize(const QSize& size) { m_size = size; }
+    void setEmpty(bool empty) { m_empty = empty; }
+
+    QSize sizeHint() const Q_DECL_OVERRIDE { return m_size; }
+    QSize minimumSize() const Q_DECL_OVERRIDE { return m_size; }
+    QSize maximumSize() const Q_DECL_OVERRIDE { return m_size; }
+    Qt::Orientations expandingDirections() const Q_DECL_OVERRIDE { return 0; }
+    bool isEmpty() const Q_DECL_OVERRIDE { return m_empty; }
+    void setGeometry(const QRect& rect) Q_DECL_OVERRIDE { m_rect = rect; }
+    QRect geometry() const Q_DECL_OVERRIDE { return m_rect; }
+
+private:
+    QSize m_size;
+    QRect m_rect;
+    bool m_empty = false;
+};
+
+static ButtonBoxItem item(const QString& id, const QString& text, bool checkable = false, bool checked = false)
+{
+    ButtonBoxItem item;
+    item.id = id;
+    item.text = text;
+    item.toolTip = text;
+    item.checkable = checkable;
+    item.checked = checked;
+    return item;
+}
+
+// "Filters" expanded, "Tools" collapsed with a checked button and a
+// sub-button, so that restoring defers it.
+static void fillBox(ButtonBox* box)
+{
+    box->addItem("Filters", item("blur", "Blur"));
+    box->addSubItem("blur", item("blur-h", "Horizontal"));
+    box->addSubItem("blur", item("blur-v", "Vertical"));
+    box->addItem("Filters", item("sharpen", "Sharpen"));
+    box->addItem("Tools", item("crop", "Crop"));
+    box->addSubItem("crop", item("crop-free", "Free"));
+    box->addItem("Tools", item("move", "Move", true, true));
+    box->setExpandedCategories(QSet<QString>() << "Filters");
+}
+
+class AutotestButtonBox : public QObject
+{
+    Q_OBJECT
+private slots:
+    void offsetIndex();
+    void offsetIndexMatchesLinearScan();
+    void prefixIndexWords();
+    void prefixIndexFind();
+    void prefixIndexNarrow();
+    void prefixIndexReinsert();
+    void flowLayoutAppend();
+    void flowLayoutAppendKeepsEveryWidth();
+    void flowLayoutHiddenItem();
+    void flowLayoutSizeHintChange();
+    void saveRestoreRoundTrip();
+    void restoreDeferredCategory();
+    void restoreExclusive();
+    void restoreCorrupt_data();
+    void restoreCorrupt();
+    void restoreTruncated();
+    void paletteLoader_data();
+    void paletteLoader();
+};
+
+void AutotestButtonBox::offsetIndex()
+{
+    OffsetIndex index;
+    QCOMPARE(index.total(), qint64(0));
+    QCOMPARE(index.indexAt(0), -1);
+
+    index.reset(QVector<int>() << 10 << 0 << 5 << 20);
+    QCOMPARE(index.count(), 4);
+    QCOMPARE(index.offset(0), qint64(0));
+    QCOMPARE(index.offset(1), qint64(10));
+    QCOMPARE(index.offset(2), qint64(10));
+    QCOMPARE(index.offset(3), qint64(15));
+    QCOMPARE(index.total(), qint64(35));
+
+    // An empty entry covers no position.
+    QCOMPARE(index.indexAt(-1), -1);
+    QCOMPARE(index.indexAt(0), 0);
+    QCOMPARE(index.indexAt(9), 0);
+    QCOMPARE(index.indexAt(10), 2);
+    QCOMPARE(index.indexAt(14), 2);
+    QCOMPARE(index.indexAt(15), 3);
+    QCOMPARE(index.indexAt(34), 3);
+    QCOMPARE(index.indexAt(35), -1);
+
+    index.setExtent(1, 7);
+    QCOMPARE(index.extent(1), 7);
+    QCOMPARE(index.offset(2), qint64(17));
+    QCOMPARE(index.total(), qint64(42));
+    QCOMPARE(index.indexAt(10), 1);
+    QCOMPARE(index.indexAt(17), 2);
+
+    index.clear();
+    QCOMPARE(index.count(), 0);
+    QCOMPARE(index.total(), qint64(0));
+}
+
+void AutotestButtonBox::offsetIndexMatchesLinearScan()
+{
+    QVector<int> extents;
+    for (int i = 0; i < 100; ++i)
+        extents.append(i * 7 % 13);
+
+    OffsetIndex index;
+    index.reset(extents);
+    for (int i = 0; i < extents.size(); i += 3) {
+        extents[i] = i % 5;
+        index.setExtent(i, extents.at(i));
+    }
+
+    qint64 offset = 0;
+    for (int i = 0; i < extents.size(); ++i) {
+        QCOMPARE(index.offset(i), offset);
+        for (int position = 0; position < extents.at(i); ++position)
+            QCOMPARE(index.indexAt(offset + position), i);
+        offset += extents.at(i);
+    }
+    QCOMPARE(index.total(), offset);
+    QCOMPARE(index.indexAt(offset), -1);
+}
+
+void AutotestButtonBox::prefixIndexWords()
+{
+    QCOMPARE(PrefixIndex::words("saveAsPNG file-name"),
+             QStringList() << "save" << "as" << "png" << "file" << "name");
+    QCOMPARE(PrefixIndex::words("  "), QStringList());
+}
+
+void AutotestButtonBox::prefixIndexFind()
+{
+    PrefixIndex index;
+    index.insert(1, QStringList() << "Gaussian Blur" << "Blurs the image");
+    index.insert(2, QStringList() << "Motion Blur");
+    index.insert(3, QStringList() << "Sharpen");
+
+    QCOMPARE(index.find("blur"), QVector<int>() << 1 << 2);
+    QCOMPARE(index.find("BL"), QVector<int>() << 1 << 2);
+    QCOMPARE(index.find("gau bl"), QVector<int>() << 1);
+    QCOMPARE(index.find("bl mo"), QVector<int>() << 2);
+    QCOMPARE(index.find("image"), QVector<int>() << 1);
+    // Words match by prefix only.
+    QCOMPARE(index.find("lur"), QVector<int>());
+    QCOMPARE(index.find(""), QVector<int>());
+    QVERIFY(index.matches(3, "sha"));
+    QVERIFY(!index.matches(3, "blur"));
+
+    index.remove(2);
+    QVERIFY(!index.contains(2));
+    QCOMPARE(index.find("blur"), QVector<int>() << 1);
+}
+
+void AutotestButtonBox::prefixIndexNarrow()
+{
+    PrefixIndex index;
+    index.insert(1, QStringList() << "Gaussian Blur");
+    index.insert(2, QStringList() << "Motion Blur");
+    index.insert(3, QStringList() << "Box Blur");
+
+    const QVector<int> bl = index.find("bl");
+    QCOMPARE(bl, QVector<int>() << 1 << 2 << 3);
+    QCOMPARE(index.narrow(bl, "blu"), bl);
+    QCOMPARE(index.narrow(bl, "blur mo"), QVector<int>() << 2);
+    QCOMPARE(index.narrow(bl, "blurry"), QVector<int>());
+
+    // Removed ids drop out of a previous result.
+    index.remove(3);
+    QCOMPARE(index.narrow(bl, "blur"), QVector<int>() << 1 << 2);
+}
+
+void AutotestButtonBox::prefixIndexReinsert()
+{
+    PrefixIndex index;
+    index.insert(1, QStringList() << "Gaussian Blur");
+    QCOMPARE(index.find("gau"), QVector<int>() << 1);
+
+    // The old words of a re-inserted id are stale.
+    index.insert(1, QStringList() << "Box");
+    QCOMPARE(index.find("gau"), QVector<int>());
+    QCOMPARE(index.find("box"), QVector<int>() << 1);
+
+    // Mostly stale entries are compacted before the next query.
+    for (int id = 10; id < 100; ++id)
+        index.insert(id, QStringList() << QString("item %1").arg(id));
+    for (int id = 10; id < 95; ++id)
+        index.remove(id);
+    QCOMPARE(index.find("item"), QVector<int>() << 95 << 96 << 97 << 98 << 99);
+    QCOMPARE(index.find("box"), QVector<int>() << 1);
+}
+
+void AutotestButtonBox::flowLayoutAppend()
+{
+    // 40 wide items with 10 spacing: two per row of 100.
+    FlowLayout layout(0, 10, 10);
+    for (int i = 0; i < 3; ++i)
+        layout.addItem(new FixedItem(QSize(40, 20)));
+    QCOMPARE(layout.heightForWidth(100), 50);
+
+    layout.addItem(new FixedItem(QSize(40, 20)));
+    layout.addItem(new FixedItem(QSize(40, 20)));
+    QCOMPARE(layout.heightForWidth(100), 80);
+
+    layout.setGeometry(QRect(0, 0, 100, 80));
+    QCOMPARE(layout.itemAt(2)->geometry(), QRect(0, 30, 40, 20));
+    QCOMPARE(layout.itemAt(3)->geometry(), QRect(50, 30, 40, 20));
+    QCOMPARE(layout.itemAt(4)->geometry(), QRect(0, 60, 40, 20));
+}
+
+void AutotestButtonBox::flowLayoutAppendKeepsEveryWidth()
+{
+    FlowLayout layout(0, 10, 10);
+    for (int i = 0; i < 3; ++i)
+        layout.addItem(new FixedItem(QSize(40, 20)));
+    QCOMPARE(layout.heightForWidth(100), 50);
+    QCOMPARE(layout.heightForWidth(200), 20);
+
+    // Both cached widths continue from their own tail.
+    layout.addItem(new FixedItem(QSize(40, 20)));
+    layout.addItem(new FixedItem(QSize(40, 20)));
+    QCOMPARE(layout.heightForWidth(200), 50);
+    QCOMPARE(layout.heightForWidth(100), 80);
+}
+
+void AutotestButtonBox::flowLayoutHiddenItem()
+{
+    FlowLayout layout(0, 10, 10);
+    QList<FixedItem*> items;
+    for (int i = 0; i < 3; ++i) {
+        items.append(new FixedItem(QSize(40, 20)));
+        layout.addItem(items.last());
+    }
+    QCOMPARE(layout.heightForWidth(100), 50);
+
+    // Hiding a widget invalidates its layout, the item takes no space.
+    items.at(1)->setEmpty(true);
+    layout.invalidate();
+    QCOMPARE(layout.heightForWidth(100), 20);
+    layout.setGeometry(QRect(0, 0, 100, 20));
+    QCOMPARE(items.at(2)->geometry(), QRect(50, 0, 40, 20));
+
+    items.at(1)->setEmpty(false);
+    layout.invalidate();
+    QCOMPARE(layout.heightForWidth(100), 50);
+    layout.setGeometry(QRect(0, 0, 100, 50));
+    QCOMPARE(items.at(1)->geometry(), QRect(50, 0, 40, 20));
+    QCOMPARE(items.at(2)->geometry(), QRect(0, 30, 40, 20));
+}
+
+void AutotestButtonBox::flowLayoutSizeHintChange()
+{
+    FlowLayout layout(0, 10, 10);
+    QList<FixedItem*> items;
+    for (int i = 0; i < 3; ++i) {
+        items.append(new FixedItem(QSize(40, 20)));
+        layout.addItem(items.last());
+    }
+    layout.setGeometry(QRect(0, 0, 100, 50));
+    QCOMPARE(items.at(1)->geometry(), QRect(50, 0, 40, 20));
+
+    // A change before the tail reflows everything after it.
+    items.at(0)->setSize(QSize(80, 20));
+    layout.invalidate();
+    QCOMPARE(layout.heightForWidth(100), 50);
+    layout.setGeometry(QRect(0, 0, 100, 50));
+    QCOMPARE(items.at(0)->geometry(), QRect(0, 0, 80, 20));
+    QCOMPARE(items.at(1)->geometry(), QRect(0, 30, 40, 20));
+    QCOMPARE(items.at(2)->geometry(), QRect(50, 30, 40, 20));
+}
+
+void AutotestButtonBox::saveRestoreRoundTrip()
+{
+    ButtonBox box;
+    fillBox(&box);
+    const QByteArray state = box.saveState();
+    QVERIFY(!state.isEmpty());
+
+    ButtonBox restored;
+    QVERIFY(restored.restoreState(state));
+    QCOMPARE(restored.categories(), QStringList() << "Filters" << "Tools");
+    QVERIFY(restored.isExpanded("Filters"));
+    QVERIFY(!restored.isExpanded("Tools"));
+    QCOMPARE(restored.button("blur-v")->text(), QString("Vertical"));
+
+    // Saved again before the collapsed category is built.
+    QCOMPARE(restored.saveState(), state);
+}
+
+void AutotestButtonBox::restoreDeferredCategory()
+{
+    ButtonBox box;
+    fillBox(&box);
+
+    ButtonBox restored;
+    QVERIFY(restored.restoreState(box.saveState()));
+
+    // Sub-items of an unbuilt parent wait with it.
+    restored.addSubItem("crop", item("crop-square", "Square"));
+
+    QToolButton* subButton = restored.button("crop-free");
+    QVERIFY(subButton);
+    QCOMPARE(subButton->text(), QString("Free"));
+    QVERIFY(restored.button("crop-square"));
+    QVERIFY(restored.button("move"));
+    QVERIFY(restored.button("move")->isChecked());
+
+    const QByteArray rebuilt = restored.saveState();
+    ButtonBox again;
+    QVERIFY(again.restoreState(rebuilt));
+    QCOMPARE(again.button("crop-square")->text(), QString("Square"));
+}
+
+void AutotestButtonBox::restoreExclusive()
+{
+    ButtonBox box;
+    fillBox(&box);
+
+    // The checked button of the collapsed category is built right away.
+    ButtonBox restored;
+    restored.setExclusive(true);
+    QVERIFY(restored.restoreState(box.saveState()));
+    QVERIFY(restored.checkedButton());
+    QCOMPARE(restored.buttonId(restored.checkedButton()), QString("move"));
+    QCOMPARE(restored.checkedButton("Tools"), restored.checkedButton());
+    QVERIFY(!restored.isExpanded("Tools"));
+}
+
+void AutotestButtonBox::restoreCorrupt_data()
+{
+    ButtonBox box;
+    fillBox(&box);
+    const QByteArray state = box.saveState();
+
+    QTest::addColumn<QByteArray>("state");
+
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("garbage") << QByteArray("not a button box state");
+
+    QByteArray magic = state;
+    magic[0] = magic.at(0) ^ 0x55;
+    QTest::newRow("magic") << magic;
+
+    QByteArray version = state;
+    version[7] = version.at(7) + 1;
+    QTest::newRow("version") << version;
+
+    // More strings than the data holds.
+    QByteArray strings = state;
+    for (int i = 8; i < 12; ++i)
+        strings[i] = char(0xff);
+    QTest::newRow("string count") << strings;
+}
+
+void AutotestButtonBox::restoreCorrupt()
+{
+    QFETCH(QByteArray, state);
+
+    // A state that does not parse leaves the box untouched.
+    ButtonBox box;
+    box.addItem("Keep", item("keep", "Keep"));
+    QVERIFY(!box.restoreState(state));
+    QCOMPARE(box.categories(), QStringList() << "Keep");
+    QVERIFY(box.button("keep"));
+}
+
+void AutotestButtonBox::restoreTruncated()
+{
+    ButtonBox source;
+    fillBox(&source);
+    const QByteArray state = source.saveState();
+
+    ButtonBox box;
+    box.addItem("Keep", item("keep", "Keep"));
+    for (int size = 0; size < state.size(); ++size) {
+        if (box.restoreState(state.left(size)))
+            QFAIL(qPrintable(QString("restored a state truncated to %1 of %2 bytes").arg(size).arg(state.size())));
+    }
+    QCOMPARE(box.categories(), QStringList() << "Keep");
+}
+
+void AutotestButtonBox::paletteLoader_data()
+{
+    QTest::addColumn<QByteArray>("xml");
+    QTest::addColumn<bool>("ok");
+    QTest::addColumn<QStringList>("ids");
+
+    QTest::newRow("valid")
+            << QByteArray("<palette><category title=\"A\"><button id=\"a\" text=\"A\">"
+                          "<button id=\"a-1\" text=\"One\"/></button></category></palette>")
+            << true << (QStringList() << "a" << "a-1");
+    // What was parsed before the error stays.
+    QTest::newRow("mismatched end tag")
+            << QByteArray("<palette><category title=\"A\"><button id=\"a\" text=\"A\"></category></palette>")
+            << false << (QStringList() << "a");
+    QTest::newRow("truncated")
+            << QByteArray("<palette><category title=\"A\"><button id=\"a\" text=\"A\"/>")
+            << false << (QStringList() << "a");
+    QTest::newRow("button outside category")
+            << QByteArray("<palette><button id=\"a\" text=\"A\"/></palette>")
+            << false << QStringList();
+    QTest::newRow("unknown element")
+            << QByteArray("<palette><category title=\"A\"><item id=\"a\"/></category></palette>")
+            << false << QStringList();
+    QTest::newRow("not xml") << QByteArray("palette") << false << QStringList();
+    QTest::newRow("empty") << QByteArray() << false << QStringList();
+}
+
+void AutotestButtonBox::paletteLoader()
+{
+    QFETCH(QByteArray, xml);
+    QFETCH(bool, ok);
+    QFETCH(QStringList, ids);
+
+    ButtonBox box;
+    QBuffer buffer(&xml);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    PaletteLoader* loader = new PaletteLoader(&box);
+    QSignalSpy finished(loader, SIGNAL(finished(bool)));
+    loader->load(&buffer);
+    QVERIFY(loader->isLoading());
+    QVERIFY(finished.wait(5000));
+
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(finished.at(0).at(0).toBool(), ok);
+    QVERIFY(!loader->isLoading());
+    QCOMPARE(loader->errorString().isEmpty(), ok);
+    foreach (const QString& id, ids)
+        QVERIFY2(box.button(id), qPrintable(id));
+}
+
+int main(int argc, char* argv[])
+{
+    // Runs headless unless a platform is picked explicitly.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    AutotestButtonBox test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "autotestbuttonbox.moc"
@@ -0,0 +1,11 @@
+CONFIG += c++11
+QT += testlib widgets
+
+include(../src/buttonbox.pri)
+
+DESTDIR = ../build
+TARGET = benchButtonBox
+TEMPLATE = app
+
+SOURCES += \
+    benchbuttonbox.cpp
@@ -0,0 +1,351 @@
+#include <buttonbox.h>
+#include <flowlayout.h>
+#include <fuzzysearch.h>
+
+#include <QtTest>
+#include <QApplication>
+#include <QToolButton>
+#include <QSpacerItem>
+#include <QMenu>
+#include <QFile>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+static const int SubButtonsPerButton = 5;
+static const int ButtonsPerCategory = 100;
+
+#ifdef Q_OS_LINUX
+// Resident set size in bytes, 0 when /proc is not available.
+static qint64 residentBytes()
+{
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+
+    const QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.size() > 1 ? fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+}
+#endif
+
+static QList<QToolButton*> populate(ButtonBox* box, int count, bool withSubButtons)
+{
+    QList<QToolButton*> buttons;
+    box->beginUpdate();
+    for (int i = 0; i < count; ++i) {
+        QToolButton* button = new QToolButton(box);
+        button->setIconSize(QSize(32, 32));
+        box->addButton(QString("Category %1").arg(i / ButtonsPerCategory), button);
+        buttons.append(button);
+
+        if (withSubButtons) {
+            for (int j = 0; j < SubButtonsPerButton; ++j) {
+                QToolButton* subButton = new QToolButton;
+                subButton->setIconSize(QSize(32, 32));
+                box->addSubButton(button, subButton);
+            }
+        }
+    }
+    box->endUpdate();
+    return buttons;
+}
+
+class BenchButtonBox : public QObject
+{
+    Q_OBJECT
+private slots:
+    void addButton_data();
+    void addButton();
+    void addSubButton_data();
+    void addSubButton();
+    void expandCollapse_data();
+    void expandCollapse();
+    void flowLayoutHeightForWidth_data();
+    void flowLayoutHeightForWidth();
+    void flowLayoutSetGeometry_data();
+    void flowLayoutSetGeometry();
+    void switchOrientation_data();
+    void switchOrientation();
+    void popupLatency_data();
+    void popupLatency();
+    void popupPageLatency_data();
+    void popupPageLatency();
+    void exclusiveSwitch_data();
+    void exclusiveSwitch();
+    void fuzzyQuery_data();
+    void fuzzyQuery();
+    void memoryPerButton_data();
+    void memoryPerButton();
+
+private:
+    void sizes();
+};
+
+void BenchButtonBox::sizes()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("100") << 100;
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+void BenchButtonBox::addButton_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::addButton()
+{
+    QFETCH(int, count);
+
+    QBENCHMARK {
+        ButtonBox box;
+        box.resize(300, 600);
+        box.show();
+        populate(&box, count, false);
+    }
+}
+
+void BenchButtonBox::addSubButton_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::addSubButton()
+{
+    QFETCH(int, count);
+
+    ButtonBox box;
+    const QList<QToolButton*> buttons = populate(&box, count / SubButtonsPerButton, false);
+
+    QBENCHMARK_ONCE {
+        box.beginUpdate();
+        for (int i = 0; i < count; ++i)
+            box.addSubButton(buttons.at(i / SubButtonsPerButton), new QToolButton);
+        box.endUpdate();
+    }
+}
+
+void BenchButtonBox::expandCollapse_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::expandCollapse()
+{
+    QFETCH(int, count);
+
+    ButtonBox box;
+    box.resize(300, 600);
+    box.show();
+    populate(&box, count, false);
+
+    QBENCHMARK {
+        box.collapseAll();
+        box.expandAll();
+    }
+}
+
+void BenchButtonBox::flowLayoutHeightForWidth_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::flowLayoutHeightForWidth()
+{
+    QFETCH(int, count);
+
+    QWidget widget;
+    FlowLayout* layout = new FlowLayout(&widget);
+    for (int i = 0; i < count; ++i)
+        layout->addItem(new QSpacerItem(40, 40));
+
+    // Sweep wider than the geometry cache so every width is a miss.
+    QBENCHMARK {
+        for (int width = 200; width < 400; width += 10)
+            layout->heightForWidth(width);
+    }
+}
+
+void BenchButtonBox::flowLayoutSetGeometry_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::flowLayoutSetGeometry()
+{
+    QFETCH(int, count);
+
+    QWidget widget;
+    FlowLayout* layout = new FlowLayout(&widget);
+    for (int i = 0; i < count; ++i)
+        layout->addItem(new QSpacerItem(40, 40));
+
+    QBENCHMARK {
+        for (int width = 200; width < 400; width += 10)
+            layout->setGeometry(QRect(0, 0, width, layout->heightForWidth(width)));
+    }
+}
+
+void BenchButtonBox::switchOrientation_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::switchOrientation()
+{
+    QFETCH(int, count);
+
+    ButtonBox box;
+    box.resize(300, 600);
+    box.show();
+    populate(&box, count, false);
+
+    // Each switch is laid out in the following event loop pass.
+    QBENCHMARK {
+        box.setOrientation(Qt::Horizontal);
+        QCoreApplication::processEvents();
+        box.setOrientation(Qt::Vertical);
+        QCoreApplication::processEvents();
+    }
+}
+
+void BenchButtonBox::popupLatency_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::popupLatency()
+{
+    QFETCH(int, count);
+
+    ButtonBox box;
+    box.resize(300, 600);
+    box.show();
+    QToolButton* button = populate(&box, count / SubButtonsPerButton, true).first();
+    QVERIFY(button->menu());
+
+    QBENCHMARK {
+        button->menu()->popup(button->mapToGlobal(QPoint(0, button->height())));
+        QCoreApplication::processEvents();
+        button->menu()->hide();
+    }
+}
+
+void BenchButtonBox::popupPageLatency_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::popupPageLatency()
+{
+    QFETCH(int, count);
+
+    ButtonBox box;
+    box.resize(300, 600);
+    box.show();
+    QToolButton* button = populate(&box, count / SubButtonsPerButton, true).first();
+    button->setCheckable(true);
+
+    // The page is built by the first toggle, the others only show it.
+    QBENCHMARK {
+        button->setChecked(true);
+        QCoreApplication::processEvents();
+        button->setChecked(false);
+        if (QWidget* popup = QApplication::activePopupWidget())
+            popup->hide();
+    }
+}
+
+void BenchButtonBox::exclusiveSwitch_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::exclusiveSwitch()
+{
+    QFETCH(int, count);
+
+    ButtonBox box;
+    box.resize(300, 600);
+    box.show();
+    const QList<QToolButton*> buttons = populate(&box, count, false);
+    foreach (QToolButton* button, buttons)
+        button->setCheckable(true);
+    box.setExclusive(true);
+
+    // Each switch unchecks the previous button only.
+    int i = 0;
+    QBENCHMARK {
+        buttons.at(i)->setChecked(true);
+        i = (i + 97) % buttons.size();
+    }
+    QVERIFY(box.checkedButton());
+}
+
+void BenchButtonBox::fuzzyQuery_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::fuzzyQuery()
+{
+    QFETCH(int, count);
+
+    static const char* const words[] = { "Gaussian", "Blur", "Median", "Sharpen", "Threshold", "Edge", "Detect" };
+    QVector<SearchEntry> entries;
+    for (int i = 0; i < count; ++i) {
+        SearchEntry entry = { i, QString("%1 %2 %3").arg(words[i % 7]).arg(words[(i / 7) % 7]).arg(i) };
+        entries.append(entry);
+    }
+
+    // Built once, as a worker does on the first query of a snapshot.
+    const TrigramIndex index(entries);
+    const auto never = []() { return false; };
+
+    QBENCHMARK {
+        index.query("gausblr", 50, never);
+    }
+}
+
+void BenchButtonBox::memoryPerButton_data()
+{
+    sizes();
+}
+
+void BenchButtonBox::memoryPerButton()
+{
+#ifdef Q_OS_LINUX
+    QFETCH(int, count);
+
+    const qint64 before = residentBytes();
+    if (before == 0)
+        QSKIP("resident set size is not available on this platform");
+
+    ButtonBox box;
+    box.resize(300, 600);
+    box.show();
+    populate(&box, count, false);
+    QCoreApplication::processEvents();
+
+    QTest::setBenchmarkResult(qreal(residentBytes() - before) / count, QTest::BytesAllocated);
+#else
+    QSKIP("resident set size is only read on Linux");
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    // Runs headless unless a platform is picked explicitly.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    BenchButtonBox bench;
+    return QTest::qExec(&bench, argc, argv);
+}
+
+#include "benchbuttonbox.moc"
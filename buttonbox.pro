@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += test
+SUBDIRS += test bench autotest
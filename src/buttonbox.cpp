@@ -1,26 +1,65 @@
 #include "buttonbox.h"
 #include "flowlayout.h"
 #include "clicklabel.h"
+#include "iconcache.h"
+#include "iconloader.h"
+#include "modeladapter.h"
+#include "tracerecorder.h"
+#include "prefixindex.h"
+#include "fuzzysearch.h"
+#include "paletteloader.h"
+#include "offsetindex.h"
 
 #include <QToolButton>
 #include <QMap>
+#include <QHash>
+#include <QVector>
 #include <QLabel>
 #include <QSpacerItem>
-#include <QDebug>
+#include <QLoggingCategory>
+#include <QElapsedTimer>
 #include <QScrollBar>
-#include <QPropertyAnimation>
+#include <QAbstractAnimation>
+#include <QEasingCurve>
 #include <QMenu>
 #include <QAction>
 #include <QApplication>
-#include <QDesktopWidget>
+#include <QScreen>
+#include <QtMath>
 #include <QPainter>
 #include <QContextMenuEvent>
 #include <QGraphicsDropShadowEffect>
 #include <QWidgetAction>
+#include <QResizeEvent>
+#include <QStyleOptionToolButton>
+#include <QToolTip>
+#include <QTimer>
+#include <QPointer>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <qdrawutil.h>
 
+#include <climits>
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(lcButtonBox, "buttonbox", QtWarningMsg)
+
+static const quint32 StateMagic = 0x42425354; // "BBST"
+static const quint32 StateVersion = 1;
 
 typedef QList<QToolButton*> QToolButtonList;
 
+static QIcon itemIcon(const ButtonBoxItem& item, const QSize& size, qreal devicePixelRatio, bool* ready = nullptr)
+{
+    if (item.icon.isNull() && !item.iconSource.isEmpty())
+        return IconLoader::instance()->icon(item.iconSource, size, devicePixelRatio, ready);
+
+    if (ready)
+        *ready = true;
+    return item.icon;
+}
+
 class ToolButtonMenu : public QMenu
 {
     Q_OBJECT
@@ -29,12 +68,36 @@ public:
     explicit ToolButtonMenu(QWidget* parent = nullptr);
 
     void addButton(QToolButton* button);
+    void insertButton(int index, QToolButton* button);
+    void removeButton(QToolButton* button);
+
+    void setProvider(QToolButton* owner, const ButtonBox::SubButtonProvider& provider);
+    bool hasProvider() const { return bool(m_provider); }
+    bool isPopulated() const { return m_populated; }
+    void setOwner(QToolButton* owner) { m_owner = owner; }
+    QToolButton* owner() const { return m_owner; }
+    void release();
+
+    // Takes back the buttons lent to a popup page.
+    void reclaimButtons();
+
+    // Time spent in the provider by the last population, -1 once taken.
+    qint64 takeBuildNsecs();
 
     QSize sizeHint() const;
 
+private slots:
+    void onAboutToShow();
+
 private:
     QToolButtonList m_buttonList;
     QBoxLayout* m_layout;
+
+    QToolButton* m_owner = nullptr;
+    ButtonBox::SubButtonProvider m_provider;
+    QToolButtonList m_providedButtons;
+    bool m_populated = false;
+    qint64 m_buildNsecs = -1;
 };
 
 ToolButtonMenu::ToolButtonMenu(QWidget *parent) : QMenu(parent)
@@ -52,6 +115,74 @@ void ToolButtonMenu::addButton(QToolButton *button)
     m_layout->addWidget(button);
 }
 
+void ToolButtonMenu::insertButton(int index, QToolButton* button)
+{
+    if (index < 0 || index > m_buttonList.size())
+        index = m_buttonList.size();
+
+    m_buttonList.insert(index, button);
+    m_layout->insertWidget(index, button);
+}
+
+void ToolButtonMenu::removeButton(QToolButton* button)
+{
+    m_providedButtons.removeOne(button);
+    if (m_buttonList.removeOne(button))
+        m_layout->removeWidget(button);
+}
+
+void ToolButtonMenu::setProvider(QToolButton* owner, const ButtonBox::SubButtonProvider& provider)
+{
+    release();
+    m_owner = owner;
+    m_provider = provider;
+    connect(this, SIGNAL(aboutToShow()), this, SLOT(onAboutToShow()), Qt::UniqueConnection);
+}
+
+void ToolButtonMenu::release()
+{
+    foreach (QToolButton* button, m_providedButtons) {
+        removeButton(button);
+        button->deleteLater();
+    }
+    m_providedButtons.clear();
+    m_populated = false;
+}
+
+void ToolButtonMenu::onAboutToShow()
+{
+    if (m_populated || !m_provider)
+        return;
+
+    TraceScope trace("ToolButtonMenu::populate");
+    QElapsedTimer timer;
+    timer.start();
+
+    m_populated = true;
+    foreach (QToolButton* button, m_provider(m_owner)) {
+        m_providedButtons.append(button);
+        addButton(button);
+    }
+
+    m_buildNsecs = timer.nsecsElapsed();
+}
+
+void ToolButtonMenu::reclaimButtons()
+{
+    for (int i = 0; i < m_buttonList.size(); ++i) {
+        QToolButton* button = m_buttonList.at(i);
+        if (m_layout->indexOf(button) == -1)
+            m_layout->insertWidget(i, button);
+    }
+}
+
+qint64 ToolButtonMenu::takeBuildNsecs()
+{
+    const qint64 nsecs = m_buildNsecs;
+    m_buildNsecs = -1;
+    return nsecs;
+}
+
 QSize ToolButtonMenu::sizeHint() const
 {
     if (m_buttonList.isEmpty())
@@ -73,10 +204,20 @@ public:
     void addButtons(const QToolButtonList& buttonList);
     void clear();
 
+    // Fixes the size to a near square grid of the buttons, narrower than
+    // maxWidth, laid out once here and reused by every popup().
+    void updatePageSize(int maxWidth);
+    // False once a button was taken away, the page must be rebuilt.
+    bool isComplete() const;
+
+    void popup(const QPoint& globalPos);
+
     QSize sizeHint() const;
 
 private:
     FlowLayout* m_layout;
+    QToolButtonList m_buttons;
+    QSize m_pageSize;
 };
 
 ButtonPopup::ButtonPopup(QWidget *parent) : QFrame(parent, Qt::Popup)
@@ -93,8 +234,10 @@ ButtonPopup::ButtonPopup(QWidget *parent) : QFrame(parent, Qt::Popup)
 
 void ButtonPopup::addButton(QToolButton* button)
 {
+    m_buttons.append(button);
     m_layout->addWidget(button);
     button->show();
+    m_pageSize = QSize();
 }
 
 void ButtonPopup::addButtons(const QToolButtonList& buttonList)
@@ -106,11 +249,72 @@ void ButtonPopup::addButtons(const QToolButtonList& buttonList)
 void ButtonPopup::clear()
 {
     m_layout->clear();
+    m_buttons.clear();
+    m_pageSize = QSize();
+}
+
+void ButtonPopup::updatePageSize(int maxWidth)
+{
+    if (m_buttons.isEmpty()) {
+        m_pageSize = QSize();
+        return;
+    }
+
+    QSize cell;
+    foreach (QToolButton* button, m_buttons)
+        cell = cell.expandedTo(button->sizeHint());
+
+    const int frame = 2 * frameWidth();
+    const QMargins margins = m_layout->contentsMargins();
+    const int columns = qCeil(qSqrt(qreal(m_buttons.size())));
+    int width = margins.left() + margins.right() + columns * cell.width()
+            + (columns - 1) * qMax(0, m_layout->horizontalSpacing());
+    width = qMax(cell.width() + margins.left() + margins.right(), qMin(width, maxWidth - frame));
+
+    m_pageSize = QSize(width + frame, m_layout->heightForWidth(width) + frame);
+    resize(m_pageSize);
+    m_layout->activate();
+}
+
+bool ButtonPopup::isComplete() const
+{
+    foreach (QToolButton* button, m_buttons) {
+        if (button->parentWidget() != this)
+            return false;
+    }
+    return true;
+}
+
+void ButtonPopup::popup(const QPoint& globalPos)
+{
+    QScreen* screen = QGuiApplication::screenAt(globalPos);
+    if (!screen)
+        screen = QGuiApplication::primaryScreen();
+    const QRect available = screen->availableGeometry();
+    // Make sure the popup is inside the screen it opens on.
+
+    QPoint pos = globalPos;
+    if ((pos.x() + sizeHint().width()) > available.right())
+        pos.setX(available.right() - sizeHint().width());
+    if ((pos.y() + sizeHint().height()) > available.bottom())
+        pos.setY(available.bottom() - sizeHint().height());
+
+    if (pos.x() < available.left())
+        pos.setX(available.left());
+    if (pos.y() < available.top())
+        pos.setY(available.top());
+    move(pos);
+
+    // Allow keyboard navigation as soon as the popup shows.
+    setFocus();
+
+    // Execute the popup. The popup will enter the event loop.
+    show();
 }
 
 QSize ButtonPopup::sizeHint() const
 {
-    return QSize(120, 80);
+    return m_pageSize.isValid() ? m_pageSize : QSize(120, 80);
 }
 
 ////////////////////////////////////////
@@ -120,6 +324,7 @@ class CategoryHeader : public QFrame
 {
     Q_OBJECT
 public:
+    enum { Height = 30 };
     explicit CategoryHeader(QWidget* parent = nullptr);
 
 public slots:
@@ -140,6 +345,8 @@ private slots:
     void onLabelClicked();
 
 private:
+    QIcon arrowIcon(bool up) const;
+
     Qt::Alignment m_textAlignment = Qt::AlignLeft | Qt::AlignVCenter;
     QString m_title = tr("Title");
     QToolButton* m_expandButton;
@@ -157,7 +364,7 @@ CategoryHeader::CategoryHeader(QWidget *parent) : QFrame(parent)
     m_expandButton->setAutoRaise(true);
     m_expandButton->setCheckable(true);
     m_expandButton->setIconSize(QSize(24, 24));
-    m_expandButton->setIcon(QIcon(":/images/arrow_down_24x24.png"));
+    m_expandButton->setIcon(arrowIcon(false));
 
     m_titleLabel = new ClickLabel(this);
     m_titleLabel->setAlignment(m_textAlignment);
@@ -166,7 +373,7 @@ CategoryHeader::CategoryHeader(QWidget *parent) : QFrame(parent)
     layout->addWidget(m_titleLabel);
     setLayout(layout);
 
-    setFixedHeight(30);
+    setFixedHeight(Height);
 
     connect(m_expandButton, SIGNAL(toggled(bool)), this, SLOT(onButtonToggled(bool)));
     connect(m_titleLabel, SIGNAL(clicked()), this, SLOT(onLabelClicked()));
@@ -199,7 +406,10 @@ QString CategoryHeader::title() const
 
 void CategoryHeader::setChecked(bool check)
 {
+    // The arrow follows even when the caller blocks signals, as a pooled
+    // header rebound to another category does.
     m_expandButton->setChecked(check);
+    m_expandButton->setIcon(arrowIcon(check));
 }
 
 bool CategoryHeader::checked() const
@@ -209,7 +419,7 @@ bool CategoryHeader::checked() const
 
 void CategoryHeader::onButtonToggled(bool toggle)
 {
-    m_expandButton->setIcon(toggle ? QIcon(":/images/arrow_up_24x24.png") : QIcon(":/images/arrow_down_24x24.png"));
+    m_expandButton->setIcon(arrowIcon(toggle));
     emit expand(!toggle);
 }
 
@@ -218,6 +428,12 @@ void CategoryHeader::onLabelClicked()
     m_expandButton->toggle();
 }
 
+QIcon CategoryHeader::arrowIcon(bool up) const
+{
+    return IconCache::instance()->icon(up ? ":/images/arrow_up_24x24.png" : ":/images/arrow_down_24x24.png",
+                                       m_expandButton->iconSize(), devicePixelRatioF());
+}
+
 ////////////////////////////////////////
 /// The CategoryContainer class
 ////////////////////////////////////////
@@ -228,11 +444,14 @@ public:
     explicit CategoryContainer(QWidget* parent = nullptr);
 
     void addButton(QToolButton* button);
-
-    int height() const { return m_layout->heightForWidth(this->width()); }
+    void insertButton(int index, QToolButton* button);
+    bool removeButton(QToolButton* button);
+    QToolButtonList buttons() const { return m_buttons; }
+    FlowLayout* flowLayout() const { return m_layout; }
 
 private:
     FlowLayout* m_layout;
+    QToolButtonList m_buttons;
 };
 
 CategoryContainer::CategoryContainer(QWidget *parent) : QWidget(parent)
@@ -243,9 +462,29 @@ CategoryContainer::CategoryContainer(QWidget *parent) : QWidget(parent)
 
 void CategoryContainer::addButton(QToolButton *button)
 {
+    m_buttons.append(button);
     m_layout->addWidget(button);
 }
 
+void CategoryContainer::insertButton(int index, QToolButton* button)
+{
+    if (index < 0 || index >= m_buttons.size()) {
+        addButton(button);
+    } else {
+        m_buttons.insert(index, button);
+        m_layout->insertWidget(index, button);
+    }
+}
+
+bool CategoryContainer::removeButton(QToolButton* button)
+{
+    if (!m_buttons.removeOne(button))
+        return false;
+
+    m_layout->removeWidget(button);
+    return true;
+}
+
 ////////////////////////////////////////
 /// The CategoryWidget class
 ////////////////////////////////////////
@@ -262,35 +501,183 @@ public:
     Qt::Alignment titleAlignment() const;
 
     void addButton(QToolButton* button);
+    void insertButton(int index, QToolButton* button);
+    void removeButton(QToolButton* button);
+    QToolButtonList buttons() const;
 
     QSize sizeHint() const;
 
     void updateGeo();
+    void setUpdatesSuspended(bool suspend);
+
+    ButtonBoxStatistics statistics() const;
+    void resetStatistics();
+    void recordPopupBuild(qint64 nsecs);
 
     void setOrientation(Qt::Orientation o);
     Qt::Orientation orientation() const;
 
+    bool isExpanded() const;
+    void setExpanded(bool expand, bool animated);
+
+    // The size along the box orientation, height when vertical and width
+    // when horizontal, last set by a geometry update or an animation frame.
+    int extent() const { return m_extent; }
+
+    // 0 expands and collapses at once.
+    void setAnimationDuration(int msecs) { m_animationDuration = msecs; }
+    void setClipExtent(int extent);
+    void finishAnimation();
+
 signals:
+    // Before anything is laid out or captured, the content may still change.
+    void aboutToExpand();
     void expanded(bool expand);
+    void extentChanged(int extent);
 
 public slots:
+    // Animated, as a click on the header.
     void expand(bool expand);
 
 protected:
     void resizeEvent(QResizeEvent *event);
     void showEvent(QShowEvent *event);
-
-private slots:
-    void onAnimationFinished();
+    void paintEvent(QPaintEvent *event);
 
 private:
+    void startAnimation();
+    void applyExpanded();
+    // Size of the laid out buttons: as high as the rows need for the width
+    // when vertical, as wide as the columns need for the height otherwise.
+    QSize contentSize() const;
+    int contentExtent() const;
+    int extentFor(int contentExtent) const;
+    void setExtent(int extent);
+
     bool m_expand = false;
+    bool m_suspended = false;
+    int m_extent = 0;
+
+    // While animating the container stays hidden and its snapshot is
+    // painted in its place, clipped to the current extent.
+    int m_animationDuration = 150;
+    bool m_animating = false;
+    int m_clipExtent = 0;
+    QPixmap m_snapshot;
+
     Qt::Orientation m_orientation = Qt::Vertical;
     CategoryHeader* m_header = nullptr;
     CategoryContainer* m_container = nullptr;
     QBoxLayout* m_layout = nullptr;
+
+    // Own counters, the layout ones are read from the FlowLayout.
+    ButtonBoxStatistics m_statistics;
+};
+
+//////////////////////////////////////
+/// The ExpandAnimator class
+//////////////////////////////////////
+// Drives the expand and collapse animations of every category from one
+// animation, so all of them advance on the same tick of Qt's animation
+// timer. After each tick frameAdvanced() lets the boxes update their
+// height once, whatever the number of animating categories.
+class ExpandAnimator : public QAbstractAnimation
+{
+    Q_OBJECT
+public:
+    static ExpandAnimator* instance();
+
+    void animate(CategoryWidget* category, int from, int to, int msecs);
+    void stop(CategoryWidget* category);
+
+    int duration() const Q_DECL_OVERRIDE { return -1; }
+
+signals:
+    void frameAdvanced();
+
+protected:
+    void updateCurrentTime(int currentTime) Q_DECL_OVERRIDE;
+
+private:
+    explicit ExpandAnimator(QObject* parent) : QAbstractAnimation(parent) {}
+
+    struct Track
+    {
+        QPointer<CategoryWidget> category;
+        int from;
+        int to;
+        int start;
+        int duration;
+    };
+
+    QList<Track> m_tracks;
+    QEasingCurve m_easing = QEasingCurve(QEasingCurve::OutCubic);
 };
 
+ExpandAnimator* ExpandAnimator::instance()
+{
+    // Owned by the application, animations cannot outlive it.
+    static QPointer<ExpandAnimator> animator;
+    if (!animator)
+        animator = new ExpandAnimator(qApp);
+    return animator;
+}
+
+void ExpandAnimator::animate(CategoryWidget* category, int from, int to, int msecs)
+{
+    stop(category);
+
+    if (state() != Running)
+        start();
+
+    Track track = { category, from, to, currentTime(), msecs };
+    m_tracks.append(track);
+}
+
+void ExpandAnimator::stop(CategoryWidget* category)
+{
+    for (int i = 0; i < m_tracks.size(); ++i) {
+        if (m_tracks.at(i).category == category) {
+            m_tracks.removeAt(i);
+            break;
+        }
+    }
+}
+
+void ExpandAnimator::updateCurrentTime(int currentTime)
+{
+    TraceScope trace("ExpandAnimator::frame");
+
+    // Finishing relayouts the category, which may start another track.
+    QList<QPointer<CategoryWidget> > finished;
+    for (int i = 0; i < m_tracks.size();) {
+        const Track& track = m_tracks.at(i);
+        if (!track.category) {
+            m_tracks.removeAt(i);
+            continue;
+        }
+
+        const qreal progress = qMin<qreal>(1, qreal(currentTime - track.start) / qMax(1, track.duration));
+        track.category->setClipExtent(track.from + qRound((track.to - track.from) * m_easing.valueForProgress(progress)));
+        if (progress >= 1) {
+            finished.append(track.category);
+            m_tracks.removeAt(i);
+        } else {
+            ++i;
+        }
+    }
+
+    foreach (const QPointer<CategoryWidget>& category, finished) {
+        if (category)
+            category->finishAnimation();
+    }
+
+    emit frameAdvanced();
+
+    if (m_tracks.isEmpty())
+        QAbstractAnimation::stop();
+}
+
 CategoryWidget::CategoryWidget(QWidget *parent) : QFrame(parent)
 {
     m_header = new CategoryHeader(this);
@@ -301,6 +688,9 @@ CategoryWidget::CategoryWidget(QWidget *parent) : QFrame(parent)
     m_layout->setSpacing(0);
     m_layout->addWidget(m_header);
     m_layout->addWidget(m_container);
+    // Keeps the header on top while the category is taller than it with
+    // the container hidden, during animations.
+    m_layout->setAlignment(m_header, Qt::AlignTop);
     setLayout(m_layout);
 
     connect(m_header, SIGNAL(expand(bool)), this, SLOT(expand(bool)));
@@ -334,39 +724,84 @@ void CategoryWidget::addButton(QToolButton* button)
     m_container->addButton(button);
 }
 
+void CategoryWidget::insertButton(int index, QToolButton* button)
+{
+    m_container->insertButton(index, button);
+}
+
+void CategoryWidget::removeButton(QToolButton* button)
+{
+    if (m_container->removeButton(button))
+        updateGeo();
+}
+
+QToolButtonList CategoryWidget::buttons() const
+{
+    return m_container->buttons();
+}
+
 QSize CategoryWidget::sizeHint() const
 {
-    return QSize(m_header->width(), m_header->height() + m_container->height());
+    if (m_orientation == Qt::Horizontal)
+        return QSize(extentFor(contentExtent()), m_header->height() + contentSize().height());
+    return QSize(m_header->width(), extentFor(contentExtent()));
 }
 
 void CategoryWidget::updateGeo()
 {
-    qDebug() << "container height: " << m_container->height();
+    // An animation sets the height itself, until it ends.
+    if (m_suspended || m_animating)
+        return;
+
+    TraceScope trace("CategoryWidget::updateGeo");
+    QElapsedTimer timer;
+    timer.start();
+
+    const int content = contentExtent();
+    qCDebug(lcButtonBox) << "category" << title() << "content extent:" << content;
+
+    setExtent(extentFor(m_container->isVisible() ? content : 0));
 
-    setFixedHeight(m_container->isVisible() ? (m_header->height() + m_container->height()) : m_header->height());
+    ++m_statistics.geometryUpdates;
+    m_statistics.geometryUpdateNsecs += timer.nsecsElapsed();
 }
 
-void CategoryWidget::setOrientation(Qt::Orientation o)
+void CategoryWidget::setUpdatesSuspended(bool suspend)
 {
-    return;
+    if (m_suspended == suspend)
+        return;
 
-    if (m_orientation != o) {
-        m_orientation = o;
+    m_suspended = suspend;
+    m_container->layout()->setEnabled(!suspend);
+    if (!suspend)
+        m_container->layout()->activate();
+}
 
-        delete m_layout;
+void CategoryWidget::setOrientation(Qt::Orientation o)
+{
+    if (m_orientation == o)
+        return;
 
-        if (m_orientation == Qt::Horizontal)
-            m_layout = new QHBoxLayout;
-        else
-            m_layout = new QVBoxLayout;
+    if (m_animating) {
+        ExpandAnimator::instance()->stop(this);
+        finishAnimation();
+    }
 
-        m_layout->setSpacing(0);
-        m_layout->setContentsMargins(0, 0, 0, 0);
+    // The header stays on top either way. Horizontally the buttons fill
+    // columns under it and the category takes the width they need.
+    m_orientation = o;
+    m_container->flowLayout()->setFlow(o == Qt::Horizontal ? FlowLayout::TopToBottom : FlowLayout::LeftToRight);
 
-        m_layout->addWidget(m_header);
-        m_layout->addWidget(m_container);
-        setLayout(m_layout);
+    // Drop the fixed size of the other direction.
+    if (o == Qt::Horizontal) {
+        setMinimumHeight(0);
+        setMaximumHeight(QWIDGETSIZE_MAX);
+    } else {
+        setMinimumWidth(0);
+        setMaximumWidth(QWIDGETSIZE_MAX);
     }
+
+    updateGeo();
 }
 
 Qt::Orientation CategoryWidget::orientation() const
@@ -374,44 +809,172 @@ Qt::Orientation CategoryWidget::orientation() const
     return m_orientation;
 }
 
+ButtonBoxStatistics CategoryWidget::statistics() const
+{
+    const FlowLayout::Statistics layout = m_container->flowLayout()->statistics();
+
+    ButtonBoxStatistics statistics = m_statistics;
+    statistics.layoutPasses = layout.layoutPasses;
+    statistics.layoutNsecs = layout.layoutNsecs;
+    statistics.itemsPositioned = layout.itemsPositioned;
+    return statistics;
+}
+
+void CategoryWidget::resetStatistics()
+{
+    m_statistics = ButtonBoxStatistics();
+    m_container->flowLayout()->resetStatistics();
+}
+
+void CategoryWidget::recordPopupBuild(qint64 nsecs)
+{
+    ++m_statistics.popupBuilds;
+    m_statistics.popupBuildNsecs += nsecs;
+}
+
+bool CategoryWidget::isExpanded() const
+{
+    return m_animating ? m_expand : !m_container->isHidden();
+}
+
 void CategoryWidget::expand(bool expand)
 {
+    setExpanded(expand, true);
+}
+
+void CategoryWidget::setExpanded(bool expand, bool animated)
+{
+    TraceScope trace("CategoryWidget::expand");
+    if (expand)
+        emit aboutToExpand();
+
     m_expand = expand;
-#if 0
-    QPropertyAnimation *animation = new QPropertyAnimation(m_container, "maximumHeight");
-    animation->setDuration(500);
-
-    //Now animation to provide a fly-by effect
-    if (expand) {
-        animation->setStartValue(0);
-        animation->setEndValue(m_container->heightForWidth(this->width()));
-    } else {
-        animation->setStartValue(m_container->heightForWidth(this->width()));
-        animation->setEndValue(0);
+    ++m_statistics.expandOperations;
+
+    if (animated && m_animationDuration > 0 && isVisible() && !m_suspended) {
+        startAnimation();
+        return;
+    }
+
+    if (m_animating) {
+        ExpandAnimator::instance()->stop(this);
+        m_animating = false;
+        m_snapshot = QPixmap();
+    }
+    applyExpanded();
+}
+
+void CategoryWidget::startAnimation()
+{
+    const int content = contentExtent();
+    const int from = m_animating ? m_clipExtent : (m_container->isHidden() ? 0 : content);
+
+    // One snapshot of the laid out content serves both directions and
+    // reversals; the container is not laid out again until the end.
+    if (m_snapshot.isNull()) {
+        TraceScope trace("CategoryWidget::snapshot");
+        m_container->resize(contentSize());
+        m_container->layout()->activate();
+        m_snapshot = m_container->grab();
+    }
+
+    const int to = m_expand ? content : 0;
+    m_container->hide();
+    m_animating = true;
+    setClipExtent(from);
+    ExpandAnimator::instance()->animate(this, from, to, m_animationDuration);
+}
+
+void CategoryWidget::setClipExtent(int extent)
+{
+    m_clipExtent = extent;
+    setExtent(extentFor(extent));
+    update();
+}
+
+QSize CategoryWidget::contentSize() const
+{
+    const FlowLayout* layout = m_container->flowLayout();
+    if (m_orientation == Qt::Horizontal) {
+        const int height = qMax(0, contentsRect().height() - m_header->height());
+        return QSize(layout->widthForHeight(height), height);
     }
 
-    connect(animation, SIGNAL(finished()), this, SLOT(onAnimationFinished()));
+    const int width = contentsRect().width();
+    return QSize(width, layout->heightForWidth(width));
+}
+
+int CategoryWidget::contentExtent() const
+{
+    const QSize size = contentSize();
+    return m_orientation == Qt::Horizontal ? size.width() : size.height();
+}
+
+int CategoryWidget::extentFor(int contentExtent) const
+{
+    // Collapsed, a horizontal category is as wide as its title.
+    if (m_orientation == Qt::Horizontal)
+        return qMax(m_header->minimumSizeHint().width(), contentExtent) + 2 * frameWidth();
+    return m_header->height() + contentExtent;
+}
 
-    animation->start();
+void CategoryWidget::setExtent(int extent)
+{
+    if (m_orientation == Qt::Horizontal)
+        setFixedWidth(extent);
+    else
+        setFixedHeight(extent);
+
+    if (m_extent != extent) {
+        m_extent = extent;
+        emit extentChanged(extent);
+    }
+}
 
-#else
-    onAnimationFinished();
-#endif
+void CategoryWidget::finishAnimation()
+{
+    m_animating = false;
+    m_snapshot = QPixmap();
+    applyExpanded();
 }
 
 void CategoryWidget::resizeEvent(QResizeEvent *event)
 {
+    // A snapshot laid out for another width, or height when horizontal,
+    // no longer fits, jump to the end.
+    const bool reflow = m_orientation == Qt::Horizontal ? event->size().height() != event->oldSize().height()
+                                                        : event->size().width() != event->oldSize().width();
+    if (m_animating && reflow) {
+        ExpandAnimator::instance()->stop(this);
+        finishAnimation();
+    }
+
     QFrame::resizeEvent(event);
     updateGeo();
 }
 
+void CategoryWidget::paintEvent(QPaintEvent *event)
+{
+    QFrame::paintEvent(event);
+    if (!m_animating)
+        return;
+
+    const QPoint origin(contentsRect().left(), m_header->geometry().bottom() + 1);
+    QPainter painter(this);
+    if (m_orientation == Qt::Horizontal)
+        painter.setClipRect(QRect(origin, QSize(m_clipExtent, contentsRect().bottom() - origin.y() + 1)));
+    else
+        painter.setClipRect(QRect(origin, QSize(contentsRect().width(), m_clipExtent)));
+    painter.drawPixmap(origin, m_snapshot);
+}
+
 void CategoryWidget::showEvent(QShowEvent *event)
 {
     QFrame::showEvent(event);
     updateGeo();
 }
 
-void CategoryWidget::onAnimationFinished()
+void CategoryWidget::applyExpanded()
 {
     m_container->setVisible(m_expand);
 
@@ -424,234 +987,2841 @@ void CategoryWidget::onAnimationFinished()
 }
 
 //////////////////////////////////////
-/// The ButtonBoxPrivate class
+/// The VirtualButtonView class
 //////////////////////////////////////
-class ButtonBoxPrivate : public QWidget
+class VirtualButtonView : public QWidget
 {
     Q_OBJECT
 public:
-    ButtonBoxPrivate(QScrollArea* q);
+    explicit VirtualButtonView(QScrollBar* scrollBar, QWidget* parent);
 
-    void updateGeo();
-    void setOrientation(Qt::Orientation o);
-    Qt::Orientation orientation() const;
+    void addItem(const QString& category, const ButtonBoxItem& item);
+    void addSubItem(const QString& parentId, const ButtonBoxItem& item);
 
-    Qt::Orientation orient = Qt::Vertical; // default to vertical
-    QScrollArea* q_ptr;
-    QMap<QString, QWidget*> categoryWidgetMap;
-    QBoxLayout* layout = nullptr;
-    QList<QToolButton*> rootButtons;
-    QMap<QToolButton*, QToolButtonList> button2SubButtonsMap;
-    QMap<QToolButton*, ToolButtonMenu*> button2MenuMap;
-    ButtonPopup* buttonPopup = nullptr;
+    void setIconSize(const QSize& size);
+    QSize iconSize() const;
 
-    QMenu* contextMenu = nullptr;
+    // Paints headers and buttons itself instead of materializing widgets.
+    void setPainted(bool painted);
+    bool isPainted() const;
+
+    void setAllExpanded(bool expand);
+
+    qint64 contentHeight() const;
+
+signals:
+    void itemTriggered(const QString& id);
+
+public slots:
+    void relayout();
+
+protected:
+    bool event(QEvent* event);
+    bool eventFilter(QObject* watched, QEvent* event);
+    void resizeEvent(QResizeEvent* event);
+    void showEvent(QShowEvent* event);
+    void paintEvent(QPaintEvent* event);
+    void mouseMoveEvent(QMouseEvent* event);
+    void mousePressEvent(QMouseEvent* event);
+    void mouseReleaseEvent(QMouseEvent* event);
+    void leaveEvent(QEvent* event);
 
 private slots:
-    void onExpand(bool expand);
-    void onButtonToggled(bool toggled);
+    void scheduleRelayout();
+    void onHeaderExpand(bool expand);
+    void onButtonClicked();
+    void onSubButtonClicked();
+    void onIconLoaded(const QString& source);
+
+private:
+    struct Category
+    {
+        QString title;
+        bool expanded = true;
+        QVector<ButtonBoxItem> items;
+    };
+
+    // A header (item == -1) or button intersecting the viewport, in view coordinates.
+    struct VisibleItem
+    {
+        int category;
+        int item;
+        QRect rect;
+    };
+
+    enum : quint64 { NoKey = ~quint64(0) };
+    static quint64 key(int category, int item) { return (quint64(category) << 32) | quint32(item); }
+
+    void updateMetrics();
+    int columns() const;
+    qint64 categoryHeight(const Category& category) const;
+    QVector<VisibleItem> visibleItems() const;
+    VisibleItem itemAt(const QPoint& pos) const;
+    QRect itemRect(quint64 k) const;
+    ButtonBoxItem& item(quint64 k);
+
+    void layoutVisible();
+    void recycleAll();
+    void bindButton(QToolButton* button, const ButtonBoxItem& item) const;
+    void triggerItem(quint64 k, const QPoint& popupPos);
+    void showSubItems(const QPoint& globalPos, const QVector<ButtonBoxItem>& items);
+
+    void paintHeader(QPainter* painter, const Category& category, const QRect& rect) const;
+    void paintButton(QPainter* painter, const ButtonBoxItem& item, const QRect& rect, quint64 k) const;
+
+    QScrollBar* m_scrollBar;
+    QVector<Category> m_categories;
+    QHash<QString, int> m_categoryIndex;
+    QHash<QString, QVector<ButtonBoxItem> > m_subItems;
+
+    QSize m_iconSize = QSize(32, 32);
+    QSize m_cellSize;
+    int m_margin = 0;
+    int m_spaceX = 0;
+    int m_spaceY = 0;
+
+    bool m_relayoutPending = false;
+    bool m_inRelayout = false;
+    bool m_relayoutAgain = false;
+
+    // Materialized widgets keyed by position, and the recycled ones.
+    QHash<quint64, QToolButton*> m_activeButtons;
+    QHash<int, CategoryHeader*> m_activeHeaders;
+    QToolButtonList m_buttonPool;
+    QList<CategoryHeader*> m_headerPool;
+
+    // Painted mode state, tracked by hit-testing.
+    bool m_painted = false;
+    quint64 m_hoverKey = NoKey;
+    quint64 m_pressedKey = NoKey;
+
+    ButtonPopup* m_subPopup = nullptr;
+    QToolButtonList m_subButtons;
 };
 
-ButtonBoxPrivate::ButtonBoxPrivate(QScrollArea *q) : q_ptr(q)
+VirtualButtonView::VirtualButtonView(QScrollBar* scrollBar, QWidget* parent) : QWidget(parent),
+    m_scrollBar(scrollBar)
 {
-    layout = new QVBoxLayout;
-    layout->setContentsMargins(0, 0, 0, 0);
-    layout->setSpacing(0);
-    setLayout(layout);
+    updateMetrics();
+
+    // Track the viewport size ourselves, the scroll area has no widget to resize.
+    parent->installEventFilter(this);
+    connect(m_scrollBar, SIGNAL(valueChanged(int)), this, SLOT(relayout()));
+    connect(IconLoader::instance(), SIGNAL(iconLoaded(QString)), this, SLOT(onIconLoaded(QString)));
 }
 
-void ButtonBoxPrivate::updateGeo()
+void VirtualButtonView::addItem(const QString& category, const ButtonBoxItem& item)
 {
-    int hei = 0;
-    auto iter = categoryWidgetMap.begin();
-    while (iter != categoryWidgetMap.end()) {
-        QWidget* widget = iter.value();
-        hei += widget->height();
-        ++iter;
+    int index = m_categoryIndex.value(category, -1);
+    if (index == -1) {
+        index = m_categories.size();
+        m_categories.append(Category());
+        m_categories.last().title = category;
+        m_categoryIndex.insert(category, index);
     }
 
-    this->setFixedHeight(hei);
+    m_categories[index].items.append(item);
+    scheduleRelayout();
 }
 
-void ButtonBoxPrivate::setOrientation(Qt::Orientation o)
+void VirtualButtonView::addSubItem(const QString& parentId, const ButtonBoxItem& item)
 {
-    if (orient != o) {
-        orient = o;
-
-        delete this->layout;
-
-        if (orient == Qt::Horizontal)
-            this->layout = new QHBoxLayout;
-        else
-            this->layout = new QVBoxLayout;
-        this->layout->setSpacing(0);
-        this->layout->setContentsMargins(0, 0, 0, 0);
+    m_subItems[parentId].append(item);
+}
 
-        QWidgetList widgets = this->categoryWidgetMap.values();
-        foreach (QWidget* widget, widgets) {
-            CategoryWidget* cw = qobject_cast<CategoryWidget*>(widget);
-            cw->setOrientation(o);
+void VirtualButtonView::setIconSize(const QSize& size)
+{
+    if (m_iconSize != size) {
+        m_iconSize = size;
+        updateMetrics();
 
-            this->layout->addWidget(widget);
-        }
+        foreach (QToolButton* button, m_activeButtons)
+            button->setIconSize(m_iconSize);
+        foreach (QToolButton* button, m_buttonPool)
+            button->setIconSize(m_iconSize);
 
-        this->setLayout(this->layout);
+        scheduleRelayout();
     }
 }
 
-Qt::Orientation ButtonBoxPrivate::orientation() const
-{
-    return this->orient;
-}
-
-void ButtonBoxPrivate::onExpand(bool expand)
+QSize VirtualButtonView::iconSize() const
 {
-    Q_UNUSED(expand)
-    updateGeo();
+    return m_iconSize;
 }
 
-void ButtonBoxPrivate::onButtonToggled(bool toggled)
+void VirtualButtonView::setPainted(bool painted)
 {
-    if (!toggled)
+    if (m_painted == painted)
         return;
 
-    if (!buttonPopup)
-        buttonPopup = new ButtonPopup;
+    m_painted = painted;
+    m_hoverKey = NoKey;
+    m_pressedKey = NoKey;
+    setMouseTracking(painted);
 
+    if (painted)
+        recycleAll();
+    relayout();
+    update();
+}
+
+bool VirtualButtonView::isPainted() const
+{
+    return m_painted;
+}
+
+void VirtualButtonView::setAllExpanded(bool expand)
+{
+    for (int i = 0; i < m_categories.size(); ++i)
+        m_categories[i].expanded = expand;
+    scheduleRelayout();
+}
+
+qint64 VirtualButtonView::contentHeight() const
+{
+    qint64 height = 0;
+    foreach (const Category& category, m_categories)
+        height += categoryHeight(category);
+    return height;
+}
+
+void VirtualButtonView::relayout()
+{
+    m_relayoutPending = false;
+    if (isHidden())
+        return;
+
+    // Updating the scroll bar range may show or hide it and resize us
+    // synchronously, in which case the pass is simply repeated.
+    if (m_inRelayout) {
+        m_relayoutAgain = true;
+        return;
+    }
+
+    TraceScope trace("VirtualButtonView::relayout");
+    m_inRelayout = true;
+    int passes = 0;
+    do {
+        m_relayoutAgain = false;
+
+        const qint64 range = contentHeight() - height();
+        m_scrollBar->setRange(0, int(qBound<qint64>(0, range, INT_MAX)));
+        m_scrollBar->setPageStep(height());
+        m_scrollBar->setSingleStep(m_cellSize.height());
+
+        layoutVisible();
+    } while (m_relayoutAgain && ++passes < 3);
+    m_inRelayout = false;
+}
+
+bool VirtualButtonView::event(QEvent* event)
+{
+    if (m_painted && event->type() == QEvent::ToolTip) {
+        QHelpEvent* helpEvent = static_cast<QHelpEvent*>(event);
+        const VisibleItem hit = itemAt(helpEvent->pos());
+        if (hit.category != -1 && hit.item != -1) {
+            const ButtonBoxItem& entry = m_categories.at(hit.category).items.at(hit.item);
+            QToolTip::showText(helpEvent->globalPos(), entry.toolTip.isEmpty() ? entry.text : entry.toolTip,
+                               this, hit.rect);
+        } else {
+            QToolTip::hideText();
+            event->ignore();
+        }
+        return true;
+    }
+
+    return QWidget::event(event);
+}
+
+bool VirtualButtonView::eventFilter(QObject* watched, QEvent* event)
+{
+    if (watched == parentWidget() && event->type() == QEvent::Resize)
+        resize(static_cast<QResizeEvent*>(event)->size());
+
+    return QWidget::eventFilter(watched, event);
+}
+
+void VirtualButtonView::resizeEvent(QResizeEvent* event)
+{
+    QWidget::resizeEvent(event);
+    relayout();
+}
+
+void VirtualButtonView::showEvent(QShowEvent* event)
+{
+    QWidget::showEvent(event);
+    relayout();
+}
+
+void VirtualButtonView::paintEvent(QPaintEvent* event)
+{
+    if (!m_painted)
+        return;
+
+    TraceScope trace("VirtualButtonView::paint");
+    QPainter painter(this);
+    foreach (const VisibleItem& visible, visibleItems()) {
+        if (!visible.rect.intersects(event->rect()))
+            continue;
+
+        const Category& category = m_categories.at(visible.category);
+        if (visible.item == -1)
+            paintHeader(&painter, category, visible.rect);
+        else
+            paintButton(&painter, category.items.at(visible.item), visible.rect, key(visible.category, visible.item));
+    }
+}
+
+void VirtualButtonView::mouseMoveEvent(QMouseEvent* event)
+{
+    QWidget::mouseMoveEvent(event);
+    if (!m_painted)
+        return;
+
+    const VisibleItem hit = itemAt(event->pos());
+    const quint64 hoverKey = hit.item != -1 ? key(hit.category, hit.item) : quint64(NoKey);
+    if (hoverKey != m_hoverKey) {
+        update(itemRect(m_hoverKey));
+        m_hoverKey = hoverKey;
+        update(hit.rect);
+    }
+}
+
+void VirtualButtonView::mousePressEvent(QMouseEvent* event)
+{
+    QWidget::mousePressEvent(event);
+    if (!m_painted || event->button() != Qt::LeftButton)
+        return;
+
+    const VisibleItem hit = itemAt(event->pos());
+    if (hit.category == -1)
+        return;
+
+    if (hit.item == -1) {
+        // Same as clicking a CategoryHeader.
+        Category& category = m_categories[hit.category];
+        category.expanded = !category.expanded;
+        relayout();
+        update();
+    } else {
+        m_pressedKey = key(hit.category, hit.item);
+        update(hit.rect);
+    }
+}
+
+void VirtualButtonView::mouseReleaseEvent(QMouseEvent* event)
+{
+    QWidget::mouseReleaseEvent(event);
+    if (!m_painted || m_pressedKey == NoKey)
+        return;
+
+    const quint64 pressedKey = m_pressedKey;
+    m_pressedKey = NoKey;
+
+    const QRect rect = itemRect(pressedKey);
+    update(rect);
+    if (rect.contains(event->pos()))
+        triggerItem(pressedKey, mapToGlobal(rect.bottomLeft()));
+}
+
+void VirtualButtonView::leaveEvent(QEvent* event)
+{
+    QWidget::leaveEvent(event);
+    if (m_hoverKey != NoKey) {
+        update(itemRect(m_hoverKey));
+        m_hoverKey = NoKey;
+    }
+}
+
+void VirtualButtonView::scheduleRelayout()
+{
+    if (!m_relayoutPending) {
+        m_relayoutPending = true;
+        QMetaObject::invokeMethod(this, "relayout", Qt::QueuedConnection);
+    }
+}
+
+void VirtualButtonView::onHeaderExpand(bool expand)
+{
+    CategoryHeader* header = qobject_cast<CategoryHeader*>(sender());
+    const int index = m_categoryIndex.value(header->title(), -1);
+    if (index != -1) {
+        m_categories[index].expanded = expand;
+        relayout();
+    }
+}
+
+void VirtualButtonView::onButtonClicked()
+{
+    QToolButton* button = qobject_cast<QToolButton*>(sender());
+    triggerItem(button->property("itemKey").toULongLong(),
+                button->mapToGlobal(QPoint(0, button->height())));
+}
+
+void VirtualButtonView::onSubButtonClicked()
+{
+    const QString id = sender()->objectName();
+    m_subPopup->hide();
+    emit itemTriggered(id);
+}
+
+void VirtualButtonView::onIconLoaded(const QString& source)
+{
+    if (m_painted) {
+        update();
+        return;
+    }
+
+    for (auto iter = m_activeButtons.constBegin(); iter != m_activeButtons.constEnd(); ++iter) {
+        const ButtonBoxItem& entry = item(iter.key());
+        if (entry.icon.isNull() && entry.iconSource == source)
+            iter.value()->setIcon(itemIcon(entry, m_iconSize, devicePixelRatioF()));
+    }
+}
+
+void VirtualButtonView::updateMetrics()
+{
+    QToolButton prototype;
+    prototype.setIconSize(m_iconSize);
+    m_cellSize = prototype.sizeHint();
+
+    m_margin = style()->pixelMetric(QStyle::PM_LayoutLeftMargin);
+    m_spaceX = qMax(0, style()->layoutSpacing(QSizePolicy::PushButton, QSizePolicy::PushButton, Qt::Horizontal));
+    m_spaceY = qMax(0, style()->layoutSpacing(QSizePolicy::PushButton, QSizePolicy::PushButton, Qt::Vertical));
+}
+
+int VirtualButtonView::columns() const
+{
+    return qMax(1, (width() - 2 * m_margin + m_spaceX) / (m_cellSize.width() + m_spaceX));
+}
+
+qint64 VirtualButtonView::categoryHeight(const Category& category) const
+{
+    if (!category.expanded || category.items.isEmpty())
+        return CategoryHeader::Height;
+
+    const int cols = columns();
+    const qint64 rows = (category.items.size() + cols - 1) / cols;
+    return CategoryHeader::Height + 2 * m_margin + rows * m_cellSize.height() + (rows - 1) * m_spaceY;
+}
+
+QVector<VirtualButtonView::VisibleItem> VirtualButtonView::visibleItems() const
+{
+    QVector<VisibleItem> visible;
+
+    const qint64 top = m_scrollBar->value();
+    const qint64 bottom = top + height();
+    const int cols = columns();
+    const int rowStep = m_cellSize.height() + m_spaceY;
+    const int colStep = m_cellSize.width() + m_spaceX;
+
+    qint64 y = 0;
+    for (int c = 0; c < m_categories.size() && y < bottom; ++c) {
+        const Category& category = m_categories.at(c);
+        const qint64 categoryBottom = y + categoryHeight(category);
+        if (categoryBottom <= top) {
+            y = categoryBottom;
+            continue;
+        }
+
+        if (y + CategoryHeader::Height > top) {
+            VisibleItem header = { c, -1, QRect(0, int(y - top), width(), CategoryHeader::Height) };
+            visible.append(header);
+        }
+
+        if (category.expanded && !category.items.isEmpty()) {
+            const qint64 base = y + CategoryHeader::Height + m_margin;
+            const int rows = (category.items.size() + cols - 1) / cols;
+            const int firstRow = int(qBound<qint64>(0, (top - base) / rowStep, rows - 1));
+            const int lastRow = bottom > base ? int(qMin<qint64>(rows - 1, (bottom - base) / rowStep)) : -1;
+
+            for (int row = firstRow; row <= lastRow; ++row) {
+                for (int col = 0; col < cols; ++col) {
+                    const int i = row * cols + col;
+                    if (i >= category.items.size())
+                        break;
+
+                    VisibleItem button = { c, i, QRect(QPoint(m_margin + col * colStep, int(base + row * rowStep - top)),
+                                                      m_cellSize) };
+                    visible.append(button);
+                }
+            }
+        }
+
+        y = categoryBottom;
+    }
+
+    return visible;
+}
+
+VirtualButtonView::VisibleItem VirtualButtonView::itemAt(const QPoint& pos) const
+{
+    foreach (const VisibleItem& visible, visibleItems()) {
+        if (visible.rect.contains(pos))
+            return visible;
+    }
+
+    VisibleItem none = { -1, -1, QRect() };
+    return none;
+}
+
+QRect VirtualButtonView::itemRect(quint64 k) const
+{
+    if (k == NoKey)
+        return QRect();
+
+    foreach (const VisibleItem& visible, visibleItems()) {
+        if (visible.item != -1 && key(visible.category, visible.item) == k)
+            return visible.rect;
+    }
+    return QRect();
+}
+
+ButtonBoxItem& VirtualButtonView::item(quint64 k)
+{
+    return m_categories[int(k >> 32)].items[int(quint32(k))];
+}
+
+void VirtualButtonView::layoutVisible()
+{
+    if (m_painted) {
+        update();
+        return;
+    }
+
+    QHash<quint64, QToolButton*> buttons;
+    QHash<int, CategoryHeader*> headers;
+
+    foreach (const VisibleItem& visible, visibleItems()) {
+        const Category& category = m_categories.at(visible.category);
+
+        if (visible.item == -1) {
+            CategoryHeader* header = m_activeHeaders.take(visible.category);
+            if (!header && !m_headerPool.isEmpty())
+                header = m_headerPool.takeLast();
+            if (!header) {
+                header = new CategoryHeader(this);
+                connect(header, SIGNAL(expand(bool)), this, SLOT(onHeaderExpand(bool)));
+            }
+
+            header->blockSignals(true);
+            header->setTitle(category.title);
+            header->setChecked(!category.expanded);
+            header->blockSignals(false);
+
+            header->setGeometry(visible.rect);
+            header->show();
+            headers.insert(visible.category, header);
+            continue;
+        }
+
+        const quint64 k = key(visible.category, visible.item);
+        QToolButton* button = m_activeButtons.take(k);
+        if (!button) {
+            if (!m_buttonPool.isEmpty()) {
+                button = m_buttonPool.takeLast();
+            } else {
+                button = new QToolButton(this);
+                button->setIconSize(m_iconSize);
+                connect(button, SIGNAL(clicked()), this, SLOT(onButtonClicked()));
+            }
+            button->setProperty("itemKey", k);
+            bindButton(button, category.items.at(visible.item));
+        }
+
+        button->setGeometry(visible.rect);
+        button->show();
+        buttons.insert(k, button);
+    }
+
+    // Whatever was not reused scrolled out of view, recycle it.
+    recycleAll();
+    m_activeButtons.swap(buttons);
+    m_activeHeaders.swap(headers);
+}
+
+void VirtualButtonView::recycleAll()
+{
+    foreach (QToolButton* button, m_activeButtons) {
+        button->hide();
+        m_buttonPool.append(button);
+    }
+    foreach (CategoryHeader* header, m_activeHeaders) {
+        header->hide();
+        m_headerPool.append(header);
+    }
+
+    m_activeButtons.clear();
+    m_activeHeaders.clear();
+}
+
+void VirtualButtonView::bindButton(QToolButton* button, const ButtonBoxItem& item) const
+{
+    button->setObjectName(item.id);
+    button->setText(item.text);
+    button->setIcon(itemIcon(item, m_iconSize, devicePixelRatioF()));
+    button->setToolTip(item.toolTip.isEmpty() ? item.text : item.toolTip);
+    button->setCheckable(item.checkable);
+    button->setChecked(item.checked);
+}
+
+void VirtualButtonView::triggerItem(quint64 k, const QPoint& popupPos)
+{
+    ButtonBoxItem& entry = item(k);
+    if (entry.checkable)
+        entry.checked = !entry.checked;
+
+    const QString id = entry.id;
+    auto iter = m_subItems.constFind(id);
+    if (iter != m_subItems.constEnd())
+        showSubItems(popupPos, iter.value());
+
+    emit itemTriggered(id);
+}
+
+void VirtualButtonView::showSubItems(const QPoint& globalPos, const QVector<ButtonBoxItem>& items)
+{
+    if (!m_subPopup)
+        m_subPopup = new ButtonPopup(this);
+
+    // Sub-buttons only exist while their popup is shown.
+    m_subPopup->clear();
+    qDeleteAll(m_subButtons);
+    m_subButtons.clear();
+
+    foreach (const ButtonBoxItem& item, items) {
+        QToolButton* subButton = new QToolButton(m_subPopup);
+        subButton->setIconSize(m_iconSize);
+        bindButton(subButton, item);
+        connect(subButton, SIGNAL(clicked()), this, SLOT(onSubButtonClicked()));
+        m_subButtons.append(subButton);
+    }
+
+    m_subPopup->addButtons(m_subButtons);
+    m_subPopup->popup(globalPos);
+}
+
+void VirtualButtonView::paintHeader(QPainter* painter, const Category& category, const QRect& rect) const
+{
+    // Mirrors CategoryHeader: raised panel, arrow, then the title.
+    const QBrush fill(QColor(100, 158, 223));
+    qDrawShadePanel(painter, rect, palette(), false, 1, &fill);
+
+    const QSize arrowSize(24, 24);
+    const QPixmap arrow = IconCache::instance()->pixmap(category.expanded ? ":/images/arrow_down_24x24.png"
+                                                                          : ":/images/arrow_up_24x24.png",
+                                                        arrowSize, QIcon::Normal, devicePixelRatioF());
+    const QRect arrowRect(rect.left() + 4, rect.top() + (rect.height() - arrowSize.height()) / 2,
+                          arrowSize.width(), arrowSize.height());
+    painter->drawPixmap(arrowRect, arrow);
+
+    const QRect textRect = rect.adjusted(arrowRect.right() + 1 + 6 - rect.left(), 0, -4, 0);
+    painter->setPen(palette().color(QPalette::WindowText));
+    painter->drawText(textRect, Qt::AlignLeft | Qt::AlignVCenter,
+                      fontMetrics().elidedText(category.title, Qt::ElideRight, textRect.width()));
+}
+
+void VirtualButtonView::paintButton(QPainter* painter, const ButtonBoxItem& item, const QRect& rect, quint64 k) const
+{
+    QStyleOptionToolButton option;
+    option.initFrom(this);
+    option.rect = rect;
+    option.text = item.text;
+    option.icon = itemIcon(item, m_iconSize, devicePixelRatioF());
+    option.iconSize = m_iconSize;
+    option.toolButtonStyle = Qt::ToolButtonIconOnly;
+    option.subControls = QStyle::SC_ToolButton;
+    option.features = QStyleOptionToolButton::None;
+
+    option.state &= ~QStyle::State_MouseOver;
+    option.state |= QStyle::State_Raised;
+    if (k == m_hoverKey)
+        option.state |= QStyle::State_MouseOver;
+    if (k == m_pressedKey && k == m_hoverKey) {
+        option.state |= QStyle::State_Sunken;
+        option.activeSubControls = QStyle::SC_ToolButton;
+    }
+    if (item.checked)
+        option.state |= QStyle::State_On;
+
+    style()->drawComplexControl(QStyle::CC_ToolButton, &option, painter, this);
+}
+
+//////////////////////////////////////
+/// The ButtonRegistry class
+//////////////////////////////////////
+// Flat storage for the categories and buttons of a ButtonBox. Records live
+// in contiguous vectors whose slots are recycled through free lists, so a
+// record index stays valid until the record is removed. Lookups by button
+// pointer, button id and category title are single hash probes.
+class ButtonRegistry
+{
+public:
+    struct CategoryRecord
+    {
+        QString title;
+        CategoryWidget* widget = nullptr;
+        bool autoCollapsed = false; // collapsed by the filter, not the user
+        int checkedButton = -1;     // record of the exclusive checked button in it
+    };
+
+    struct ButtonRecord
+    {
+        QToolButton* button = nullptr;
+        QString id;
+        int category = -1;  // category slot of a root button
+        int parent = -1;    // record of the root button a sub-button belongs to
+        ToolButtonMenu* menu = nullptr;
+        QVector<int> subButtons;
+        bool filteredOut = false;   // hidden by the filter
+    };
+
+    // Categories, in display order.
+    int categoryCount() const { return m_categoryOrder.size(); }
+    int categorySlotAt(int position) const { return m_categoryOrder.at(position); }
+    int categorySlot(const QString& title) const { return m_categoryIndex.value(title, -1); }
+    CategoryRecord& category(int slot) { return m_categories[slot]; }
+    const CategoryRecord& category(int slot) const { return m_categories.at(slot); }
+    QList<CategoryWidget*> categoryWidgets() const;
+
+    int insertCategory(int position, const QString& title, CategoryWidget* widget);
+    void renameCategory(int slot, const QString& title);
+    void removeCategory(int slot);
+
+    int indexOf(const QObject* button) const { return m_buttonIndex.value(button, -1); }
+    int indexOf(const QString& id) const { return m_idIndex.value(id, -1); }
+    ButtonRecord& record(int index) { return m_buttons[index]; }
+    const ButtonRecord& record(int index) const { return m_buttons.at(index); }
+    bool isRoot(const QObject* button) const;
+
+    int addButton(QToolButton* button, int category, int parent, int position = -1);
+    void removeButton(int index);
+    // Re-keys a button by its new object name, unless empty or taken.
+    void updateId(int index);
+
+    // Records of all root buttons, sorted.
+    QVector<int> rootButtons() const;
+    // Upper bound of the record indexes, removed ones included.
+    int buttonSlots() const { return m_buttons.size(); }
+
+private:
+    QVector<CategoryRecord> m_categories;
+    QVector<int> m_categoryOrder;
+    QVector<int> m_freeCategories;
+    QHash<QString, int> m_categoryIndex;
+
+    QVector<ButtonRecord> m_buttons;
+    QVector<int> m_freeButtons;
+    QHash<const QObject*, int> m_buttonIndex;
+    QHash<QString, int> m_idIndex;
+    quint64 m_serial = 0;
+};
+
+QList<CategoryWidget*> ButtonRegistry::categoryWidgets() const
+{
+    QList<CategoryWidget*> widgets;
+    widgets.reserve(m_categoryOrder.size());
+    foreach (int slot, m_categoryOrder)
+        widgets.append(m_categories.at(slot).widget);
+    return widgets;
+}
+
+int ButtonRegistry::insertCategory(int position, const QString& title, CategoryWidget* widget)
+{
+    int slot;
+    if (!m_freeCategories.isEmpty()) {
+        slot = m_freeCategories.takeLast();
+    } else {
+        slot = m_categories.size();
+        m_categories.append(CategoryRecord());
+    }
+
+    CategoryRecord& record = m_categories[slot];
+    record.title = title;
+    record.widget = widget;
+    m_categoryIndex.insert(title, slot);
+
+    if (position < 0 || position > m_categoryOrder.size())
+        position = m_categoryOrder.size();
+    m_categoryOrder.insert(position, slot);
+
+    return slot;
+}
+
+void ButtonRegistry::renameCategory(int slot, const QString& title)
+{
+    CategoryRecord& record = m_categories[slot];
+    m_categoryIndex.remove(record.title);
+    record.title = title;
+    m_categoryIndex.insert(title, slot);
+}
+
+void ButtonRegistry::removeCategory(int slot)
+{
+    m_categoryIndex.remove(m_categories.at(slot).title);
+    m_categoryOrder.remove(m_categoryOrder.indexOf(slot));
+    m_categories[slot] = CategoryRecord();
+    m_freeCategories.append(slot);
+}
+
+bool ButtonRegistry::isRoot(const QObject* button) const
+{
+    const int index = indexOf(button);
+    return index != -1 && m_buttons.at(index).category != -1;
+}
+
+int ButtonRegistry::addButton(QToolButton* button, int category, int parent, int position)
+{
+    int index;
+    if (!m_freeButtons.isEmpty()) {
+        index = m_freeButtons.takeLast();
+    } else {
+        index = m_buttons.size();
+        m_buttons.append(ButtonRecord());
+    }
+
+    ButtonRecord& record = m_buttons[index];
+    record.button = button;
+    record.category = category;
+    record.parent = parent;
+
+    // The object name doubles as the stable id, unnamed buttons get one.
+    record.id = button->objectName();
+    if (record.id.isEmpty() || m_idIndex.contains(record.id))
+        record.id = QString("button-%1").arg(++m_serial);
+
+    m_buttonIndex.insert(button, index);
+    m_idIndex.insert(record.id, index);
+
+    if (parent != -1) {
+        QVector<int>& subButtons = m_buttons[parent].subButtons;
+        if (position < 0 || position > subButtons.size())
+            position = subButtons.size();
+        subButtons.insert(position, index);
+    }
+
+    return index;
+}
+
+void ButtonRegistry::removeButton(int index)
+{
+    ButtonRecord& record = m_buttons[index];
+
+    const QVector<int> subButtons = record.subButtons;
+    foreach (int subButton, subButtons)
+        removeButton(subButton);
+
+    if (record.parent != -1) {
+        QVector<int>& siblings = m_buttons[record.parent].subButtons;
+        siblings.remove(siblings.indexOf(index));
+    }
+
+    m_buttonIndex.remove(record.button);
+    m_idIndex.remove(record.id);
+    record = ButtonRecord();
+    m_freeButtons.append(index);
+}
+
+void ButtonRegistry::updateId(int index)
+{
+    ButtonRecord& record = m_buttons[index];
+    const QString id = record.button->objectName();
+    if (id.isEmpty() || id == record.id || m_idIndex.contains(id))
+        return;
+
+    m_idIndex.remove(record.id);
+    record.id = id;
+    m_idIndex.insert(id, index);
+}
+
+QVector<int> ButtonRegistry::rootButtons() const
+{
+    QVector<int> roots;
+    roots.reserve(m_buttonIndex.size());
+    for (int i = 0; i < m_buttons.size(); ++i) {
+        if (m_buttons.at(i).button && m_buttons.at(i).category != -1)
+            roots.append(i);
+    }
+    return roots;
+}
+
+//////////////////////////////////////
+/// The ButtonBoxPrivate class
+//////////////////////////////////////
+class ButtonBoxPrivate : public QWidget
+{
+    Q_OBJECT
+public:
+    ButtonBoxPrivate(ButtonBox* q);
+
+    int categorySlot(const QString& category, int index = -1);
+    void addRootButton(QToolButton* button, int category);
+    void forgetButton(int index);
+    ToolButtonMenu* buttonMenu(int index);
+    ButtonPopup* popupPage(int index);
+    void dropPopupPage(int index);
+    void trimPopupPages();
+    QToolButton* createItemButton(const ButtonBoxItem& item);
+    void setIconSource(QToolButton* button, const QString& source);
+    void recordPopupBuild(int index, qint64 nsecs);
+    int categoryOf(int index) const;
+    void setExclusive(bool exclusive);
+    void setCheckedIndex(int index);
+    void trackChecked(int index, bool checked);
+
+    void indexButton(int index);
+    void setFilterText(const QString& text);
+    void applyFilter(const QVector<int>& matches, bool active);
+
+    void setSearchText(const QString& text);
+    void invalidateSearch();
+    Q_INVOKABLE void runSearch();
+    QVector<SearchEntry> searchEntries() const;
+    void showSearchResults(const QVector<SearchHit>& hits);
+
+    // The search results category first, then the registry ones.
+    QList<CategoryWidget*> layoutWidgets() const;
+    int layoutOffset() const { return searchCategory ? 1 : 0; }
+
+    // Restored items of a collapsed category, its buttons not made yet.
+    struct DeferredCategory
+    {
+        QList<ButtonBoxItem> items;
+        QHash<QString, QList<ButtonBoxItem> > subItems;
+
+        bool hasChecked() const;
+    };
+
+    void addItems(int category, const QList<ButtonBoxItem>& items);
+    void deferCategory(int category, const DeferredCategory& content);
+    DeferredCategory takeDeferred(int category);
+    void buildDeferred(int category);
+    void buildAllDeferred();
+    ButtonBoxItem buttonItem(int index) const;
+    void schedulePopulation();
+    int nextPopulationCategory() const;
+    void cancelPopulation(int category);
+
+    void setCategoryExpanded(int slot, bool expand);
+    // Closes the update opened by pending expansion changes, laying them out.
+    void flushExpansion();
+
+    // Offsets of the layout widgets along the orientation, rebuilt after
+    // categories come or go and updated in place when one changes its extent.
+    void ensureOffsets();
+    void invalidateOffsets() { offsetsDirty = true; }
+    static int extent(const CategoryWidget* cw) { return cw->isHidden() ? 0 : cw->extent(); }
+    // Content position of the top, or left when horizontal, of a button,
+    // expanding its category.
+    int buttonOffset(int index);
+
+    void updateGeo();
+    void setOrientation(Qt::Orientation o);
+    Qt::Orientation orientation() const;
+
+    Qt::Orientation orient = Qt::Vertical; // default to vertical
+    ButtonBox* q_ptr;
+    QBoxLayout* layout = nullptr;
+    ButtonRegistry registry;
+    // Sub-button popup pages of root buttons by record, built on the first
+    // toggle and kept for the most recently used ones. A page borrows the
+    // sub-buttons from the menu, which takes them back when it shows.
+    QHash<int, ButtonPopup*> popupPages;
+    QList<int> popupOrder;
+    int popupPageLimit = 8;
+
+    // Exclusive mode keeps the record of the single checked button, so a
+    // switch only unchecks, and repaints, the previous one.
+    bool exclusive = false;
+    int checkedIndex = -1;
+
+    // Provider backed menus holding sub-buttons, most recently shown first.
+    QList<ToolButtonMenu*> populatedMenus;
+    int populatedMenuLimit = 0;
+
+    QMenu* contextMenu = nullptr;
+
+    int updateDepth = 0;
+    bool expansionPending = false; // inside an update flushed by flushExpansion()
+
+    OffsetIndex categoryOffsets;
+    QVector<CategoryWidget*> offsetWidgets;
+    QHash<const CategoryWidget*, int> offsetPositions;
+    bool offsetsDirty = true;
+    bool geoPending = false; // updateGeo() queued by an extent change
+    int animationDuration = 150;
+
+    ButtonBox::ViewMode viewMode = ButtonBox::WidgetView;
+    VirtualButtonView* virtualView = nullptr;
+    QSize itemIconSize = QSize(32, 32);
+
+    ModelAdapter* modelAdapter = nullptr;
+    PaletteLoader* paletteLoader = nullptr;
+
+    // Root buttons by text, tool tip and object name. Each step keeps the
+    // matches of one typed prefix of the filter, so that a keystroke
+    // narrows the previous result and a backspace pops it.
+    struct FilterStep
+    {
+        QString text;
+        QVector<int> matches;
+    };
+    PrefixIndex filterIndex;
+    QString filterText;
+    QVector<FilterStep> filterSteps;
+    QVector<int> filterMatches;
+    bool filterApplied = false; // roots outside filterMatches are hidden
+
+    // Fuzzy search, re-snapshotted on the first query after a change. The
+    // result proxies are reused from one query to the next.
+    FuzzySearch* fuzzySearch = nullptr;
+    QString searchText;
+    int searchResultLimit = 50;
+    bool searchDirty = true;
+    bool searchPending = false;
+    CategoryWidget* searchCategory = nullptr;
+    QToolButtonList searchButtons;
+
+    // Items waiting for their buttons, by category slot, and sub-items
+    // waiting for their parent, by parent id.
+    QHash<int, QList<ButtonBoxItem> > pendingItems;
+    QHash<QString, QList<ButtonBoxItem> > pendingSubItems;
+    // Buttons showing a placeholder, by the icon source they wait for.
+    QMultiHash<QString, QPointer<QToolButton> > iconWaiters;
+
+    // Restored buttons of collapsed categories, made on first expansion.
+    QHash<int, DeferredCategory> deferredCategories;
+    // Category of every item id, root or sub, waiting in deferredCategories.
+    QHash<QString, int> deferredIds;
+    QPoint restoredScrollPosition = QPoint(-1, -1);
+
+    QTimer* populationTimer = nullptr;
+    int populationBudget = 8;
+    int populationDone = 0;
+    int populationTotal = 0;
+
+private slots:
+    void onExpand(bool expand);
+    void onAboutToExpand();
+    void onButtonToggled(bool toggled);
+    void onButtonDestroyed(QObject* object);
+    void onItemClicked();
+    void onProviderMenuAboutToShow();
+    void onAnimationFrame();
+    void onMenuAboutToShow();
+    void onExpansionQueued();
+    void onCategoryExtentChanged();
+    void flushGeo();
+    void onSearchFinished(const QVector<SearchHit>& hits);
+    void onSearchButtonClicked();
+    void populateChunk();
+    void onIconLoaded(const QString& source);
+};
+
+ButtonBoxPrivate::ButtonBoxPrivate(ButtonBox *q) : q_ptr(q)
+{
+    layout = new QVBoxLayout;
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->setSpacing(0);
+    setLayout(layout);
+
+    connect(IconLoader::instance(), SIGNAL(iconLoaded(QString)), this, SLOT(onIconLoaded(QString)));
+    connect(ExpandAnimator::instance(), SIGNAL(frameAdvanced()), this, SLOT(onAnimationFrame()));
+}
+
+int ButtonBoxPrivate::categorySlot(const QString& category, int index)
+{
+    int slot = registry.categorySlot(category);
+    if (slot == -1) {
+        CategoryWidget* cw = new CategoryWidget(q_ptr);
+        cw->setTitle(category);
+        cw->setAnimationDuration(animationDuration);
+        cw->setUpdatesSuspended(updateDepth > 0);
+        cw->setOrientation(orient);
+        slot = registry.insertCategory(index, category, cw);
+        layout->insertWidget(index < 0 ? -1 : index + layoutOffset(), cw);
+        connect(cw, SIGNAL(expanded(bool)), this, SLOT(onExpand(bool)));
+        connect(cw, SIGNAL(aboutToExpand()), this, SLOT(onAboutToExpand()));
+        connect(cw, SIGNAL(extentChanged(int)), this, SLOT(onCategoryExtentChanged()));
+        invalidateOffsets();
+    }
+    return slot;
+}
+
+void ButtonBoxPrivate::addRootButton(QToolButton* button, int category)
+{
+    Q_ASSERT_X(registry.indexOf(button) == -1, "addButton", "button is already in the box");
+
+    connect(button, SIGNAL(toggled(bool)), this, SLOT(onButtonToggled(bool)), Qt::UniqueConnection);
+    connect(button, SIGNAL(destroyed(QObject*)), this, SLOT(onButtonDestroyed(QObject*)), Qt::UniqueConnection);
+    const int index = registry.addButton(button, category, -1);
+    indexButton(index);
+    trackChecked(index, button->isChecked());
+}
+
+void ButtonBoxPrivate::indexButton(int index)
+{
+    ButtonRegistry::ButtonRecord& record = registry.record(index);
+    filterIndex.insert(index, QStringList() << record.button->text()
+                                            << record.button->toolTip()
+                                            << record.button->objectName());
+
+    invalidateSearch();
+
+    // Cached steps may no longer hold, the next keystroke starts over.
+    filterSteps.clear();
+    if (filterText.isEmpty())
+        return;
+
+    QVector<int>::iterator iter = std::lower_bound(filterMatches.begin(), filterMatches.end(), index);
+    const bool listed = iter != filterMatches.end() && *iter == index;
+    const bool matches = filterIndex.matches(index, filterText);
+    if (matches && !listed)
+        filterMatches.insert(iter, index);
+    else if (!matches && listed)
+        filterMatches.erase(iter);
+
+    if (matches != record.filteredOut)
+        return;
+
+    record.filteredOut = !matches;
+    record.button->setVisible(matches);
+
+    ButtonRegistry::CategoryRecord& category = registry.category(record.category);
+    if (matches && category.autoCollapsed) {
+        category.autoCollapsed = false;
+        category.widget->setExpanded(true, false);
+    } else if (!matches && !category.autoCollapsed && category.widget->isExpanded()) {
+        foreach (int match, filterMatches) {
+            if (registry.record(match).category == record.category)
+                return;
+        }
+        category.autoCollapsed = true;
+        category.widget->setExpanded(false, false);
+    }
+}
+
+void ButtonBoxPrivate::setFilterText(const QString& text)
+{
+    const QString query = text.trimmed().toCaseFolded();
+    if (query == filterText)
+        return;
+
+    if (!query.isEmpty())
+        buildAllDeferred();
+
+    if (query.isEmpty()) {
+        filterSteps.clear();
+        filterText.clear();
+        applyFilter(QVector<int>(), false);
+        return;
+    }
+
+    while (!filterSteps.isEmpty() && !query.startsWith(filterSteps.last().text))
+        filterSteps.removeLast();
+
+    // A backspace back to a typed prefix reuses its step as is.
+    if (filterSteps.isEmpty() || filterSteps.last().text != query) {
+        FilterStep step;
+        step.text = query;
+        if (filterSteps.isEmpty())
+            step.matches = filterIndex.find(query);
+        else
+            step.matches = filterIndex.narrow(filterSteps.last().matches, query);
+        filterSteps.append(step);
+    }
+
+    filterText = query;
+    applyFilter(filterSteps.last().matches, true);
+}
+
+void ButtonBoxPrivate::applyFilter(const QVector<int>& matches, bool active)
+{
+    TraceScope trace("ButtonBox::applyFilter");
+
+    // Only the buttons entering or leaving the visible set are touched, all
+    // in one update so the categories reflow once. While a filter applies
+    // the visible set is filterMatches, so a keystroke only compares the
+    // old and new matches; turning the filter on or off lists every root.
+    q_ptr->beginUpdate();
+
+    const QVector<int> before = filterApplied ? filterMatches : registry.rootButtons();
+    const QVector<int> visible = active ? matches : registry.rootButtons();
+    QVector<int> hidden;
+    QVector<int> shown;
+    std::set_difference(before.constBegin(), before.constEnd(), visible.constBegin(), visible.constEnd(),
+                        std::back_inserter(hidden));
+    std::set_difference(visible.constBegin(), visible.constEnd(), before.constBegin(), before.constEnd(),
+                        std::back_inserter(shown));
+
+    foreach (int index, hidden) {
+        ButtonRegistry::ButtonRecord& record = registry.record(index);
+        if (!record.filteredOut) {
+            record.filteredOut = true;
+            record.button->hide();
+        }
+    }
+    foreach (int index, shown) {
+        ButtonRegistry::ButtonRecord& record = registry.record(index);
+        if (record.filteredOut) {
+            record.filteredOut = false;
+            record.button->show();
+        }
+    }
+
+    // Categories without a match collapse until they match again.
+    QVector<bool> hasMatch;
+    if (active) {
+        foreach (int index, matches) {
+            const int category = registry.record(index).category;
+            if (category >= hasMatch.size())
+                hasMatch.resize(category + 1);
+            hasMatch[category] = true;
+        }
+    }
+
+    for (int i = 0; i < registry.categoryCount(); ++i) {
+        ButtonRegistry::CategoryRecord& category = registry.category(registry.categorySlotAt(i));
+        const bool matched = !active || hasMatch.value(registry.categorySlotAt(i));
+        if (!matched && !category.autoCollapsed && category.widget->isExpanded()) {
+            category.autoCollapsed = true;
+            category.widget->setExpanded(false, false);
+        } else if (matched && category.autoCollapsed) {
+            category.autoCollapsed = false;
+            category.widget->setExpanded(true, false);
+        }
+    }
+
+    filterMatches = active ? matches : QVector<int>();
+    filterApplied = active;
+
+    q_ptr->endUpdate();
+}
+
+void ButtonBoxPrivate::setSearchText(const QString& text)
+{
+    const QString query = text.trimmed();
+    if (query == searchText)
+        return;
+
+    searchText = query;
+    if (searchText.isEmpty()) {
+        if (fuzzySearch)
+            fuzzySearch->cancel();
+        showSearchResults(QVector<SearchHit>());
+        return;
+    }
+
+    runSearch();
+}
+
+void ButtonBoxPrivate::invalidateSearch()
+{
+    searchDirty = true;
+
+    // Results of the running query may name removed records, drop them.
+    if (fuzzySearch)
+        fuzzySearch->cancel();
+
+    // Rerun once per event loop pass, not once per button of a batch.
+    if (!searchText.isEmpty() && !searchPending) {
+        searchPending = true;
+        QMetaObject::invokeMethod(this, "runSearch", Qt::QueuedConnection);
+    }
+}
+
+QVector<SearchEntry> ButtonBoxPrivate::searchEntries() const
+{
+    QVector<SearchEntry> entries;
+    entries.reserve(registry.buttonSlots());
+    for (int i = 0; i < registry.buttonSlots(); ++i) {
+        const QToolButton* button = registry.record(i).button;
+        if (!button)
+            continue;
+
+        QStringList texts;
+        texts << button->text() << button->toolTip() << button->objectName();
+        texts.removeDuplicates();
+        SearchEntry entry = { i, texts.join(' ') };
+        entries.append(entry);
+    }
+    return entries;
+}
+
+void ButtonBoxPrivate::runSearch()
+{
+    searchPending = false;
+    if (searchText.isEmpty())
+        return;
+
+    // Building marks the search dirty again, it is rerun right below.
+    buildAllDeferred();
+    searchPending = false;
+
+    if (!fuzzySearch) {
+        fuzzySearch = new FuzzySearch(this);
+        connect(fuzzySearch, SIGNAL(finished(QVector<SearchHit>)), this, SLOT(onSearchFinished(QVector<SearchHit>)));
+    }
+
+    if (searchDirty) {
+        TraceScope trace("ButtonBox::snapshotSearch");
+        fuzzySearch->setEntries(searchEntries());
+        searchDirty = false;
+    }
+
+    fuzzySearch->search(searchText, searchResultLimit);
+}
+
+void ButtonBoxPrivate::onSearchFinished(const QVector<SearchHit>& hits)
+{
+    showSearchResults(hits);
+    emit q_ptr->searchFinished(hits.size());
+}
+
+void ButtonBoxPrivate::showSearchResults(const QVector<SearchHit>& hits)
+{
+    if (!searchCategory) {
+        if (hits.isEmpty() && searchText.isEmpty())
+            return;
+
+        searchCategory = new CategoryWidget(q_ptr);
+        searchCategory->setTitle(tr("Search results"));
+        searchCategory->setAnimationDuration(animationDuration);
+        searchCategory->setUpdatesSuspended(updateDepth > 0);
+        searchCategory->setOrientation(orient);
+        layout->insertWidget(0, searchCategory);
+        connect(searchCategory, SIGNAL(expanded(bool)), this, SLOT(onExpand(bool)));
+        connect(searchCategory, SIGNAL(extentChanged(int)), this, SLOT(onCategoryExtentChanged()));
+    }
+
+    TraceScope trace("ButtonBox::showSearchResults");
+    q_ptr->beginUpdate();
+
+    // Results point at records, which the snapshot matched when the query
+    // ran; removals since then invalidated the search and rerun it.
+    QVector<int> targets;
+    foreach (const SearchHit& hit, hits) {
+        if (hit.id < registry.buttonSlots() && registry.record(hit.id).button)
+            targets.append(hit.id);
+    }
+
+    while (searchButtons.size() > targets.size()) {
+        QToolButton* proxy = searchButtons.takeLast();
+        searchCategory->removeButton(proxy);
+        proxy->hide();
+        proxy->deleteLater();
+    }
+
+    for (int i = 0; i < targets.size(); ++i) {
+        if (i == searchButtons.size()) {
+            QToolButton* proxy = new QToolButton(searchCategory);
+            connect(proxy, SIGNAL(clicked()), this, SLOT(onSearchButtonClicked()));
+            searchButtons.append(proxy);
+            searchCategory->addButton(proxy);
+        }
+
+        const ButtonRegistry::ButtonRecord& record = registry.record(targets.at(i));
+        QToolButton* proxy = searchButtons.at(i);
+        proxy->setProperty("searchTarget", record.id);
+        proxy->setText(record.button->text());
+        proxy->setIcon(record.button->icon());
+        proxy->setIconSize(record.button->iconSize());
+        proxy->setToolTip(record.button->toolTip().isEmpty() ? record.button->text() : record.button->toolTip());
+        proxy->show();
+    }
+
+    searchCategory->setVisible(!searchText.isEmpty());
+    invalidateOffsets();
+
+    q_ptr->endUpdate();
+}
+
+void ButtonBoxPrivate::onSearchButtonClicked()
+{
+    QToolButton* target = q_ptr->button(sender()->property("searchTarget").toString());
+    if (target)
+        target->click();
+}
+
+void ButtonBoxPrivate::addItems(int category, const QList<ButtonBoxItem>& items)
+{
+    CategoryWidget* cw = registry.category(category).widget;
+    foreach (const ButtonBoxItem& item, items) {
+        QToolButton* button = createItemButton(item);
+        cw->addButton(button);
+        addRootButton(button, category);
+
+        foreach (const ButtonBoxItem& subItem, pendingSubItems.take(item.id))
+            q_ptr->addSubButton(button, createItemButton(subItem));
+    }
+}
+
+bool ButtonBoxPrivate::DeferredCategory::hasChecked() const
+{
+    foreach (const ButtonBoxItem& item, items) {
+        if (item.checked)
+            return true;
+    }
+    for (auto iter = subItems.constBegin(); iter != subItems.constEnd(); ++iter) {
+        foreach (const ButtonBoxItem& item, iter.value()) {
+            if (item.checked)
+                return true;
+        }
+    }
+    return false;
+}
+
+void ButtonBoxPrivate::deferCategory(int category, const DeferredCategory& content)
+{
+    deferredCategories.insert(category, content);
+    foreach (const ButtonBoxItem& item, content.items)
+        deferredIds.insert(item.id, category);
+    for (auto iter = content.subItems.constBegin(); iter != content.subItems.constEnd(); ++iter) {
+        foreach (const ButtonBoxItem& item, iter.value())
+            deferredIds.insert(item.id, category);
+    }
+}
+
+ButtonBoxPrivate::DeferredCategory ButtonBoxPrivate::takeDeferred(int category)
+{
+    const DeferredCategory deferred = deferredCategories.take(category);
+    foreach (const ButtonBoxItem& item, deferred.items)
+        deferredIds.remove(item.id);
+    for (auto iter = deferred.subItems.constBegin(); iter != deferred.subItems.constEnd(); ++iter) {
+        foreach (const ButtonBoxItem& item, iter.value())
+            deferredIds.remove(item.id);
+    }
+    return deferred;
+}
+
+void ButtonBoxPrivate::buildDeferred(int category)
+{
+    if (!deferredCategories.contains(category))
+        return;
+
+    const DeferredCategory deferred = takeDeferred(category);
+
+    TraceScope trace("ButtonBox::buildDeferred");
+    q_ptr->beginUpdate();
+    for (auto sub = deferred.subItems.constBegin(); sub != deferred.subItems.constEnd(); ++sub)
+        pendingSubItems[sub.key()] += sub.value();
+    addItems(category, deferred.items);
+    q_ptr->endUpdate();
+}
+
+void ButtonBoxPrivate::buildAllDeferred()
+{
+    if (deferredCategories.isEmpty())
+        return;
+
+    q_ptr->beginUpdate();
+    foreach (int category, deferredCategories.keys())
+        buildDeferred(category);
+    q_ptr->endUpdate();
+}
+
+ButtonBoxItem ButtonBoxPrivate::buttonItem(int index) const
+{
+    const ButtonRegistry::ButtonRecord& record = registry.record(index);
+
+    ButtonBoxItem item;
+    item.id = record.id;
+    item.text = record.button->text();
+    item.toolTip = record.button->toolTip();
+    item.iconSource = record.button->property("iconSource").toString();
+    item.checkable = record.button->isCheckable();
+    item.checked = record.button->isChecked();
+    return item;
+}
+
+void ButtonBoxPrivate::schedulePopulation()
+{
+    if (!populationTimer) {
+        populationTimer = new QTimer(this);
+        populationTimer->setSingleShot(true);
+        populationTimer->setInterval(0);
+        connect(populationTimer, SIGNAL(timeout()), this, SLOT(populateChunk()));
+    }
+
+    if (!populationTimer->isActive())
+        populationTimer->start();
+}
+
+int ButtonBoxPrivate::nextPopulationCategory() const
+{
+    // The pending category closest to the visible part of the box, earlier
+    // ones winning ties. Along x when horizontal.
+    const bool horizontal = orient == Qt::Horizontal;
+    const QScrollBar* scrollBar = horizontal ? q_ptr->horizontalScrollBar() : q_ptr->verticalScrollBar();
+    const int top = scrollBar->value();
+    const int bottom = top + (horizontal ? q_ptr->viewport()->width() : q_ptr->viewport()->height());
+
+    int best = -1;
+    int bestDistance = INT_MAX;
+    for (int i = 0; i < registry.categoryCount(); ++i) {
+        const int slot = registry.categorySlotAt(i);
+        if (!pendingItems.contains(slot))
+            continue;
+
+        const QRect rect = registry.category(slot).widget->geometry();
+        const int first = horizontal ? rect.left() : rect.top();
+        const int last = horizontal ? rect.right() : rect.bottom();
+        int distance = 0;
+        if (last < top)
+            distance = top - last;
+        else if (first > bottom)
+            distance = first - bottom;
+
+        if (distance < bestDistance) {
+            best = slot;
+            bestDistance = distance;
+            if (distance == 0)
+                break;
+        }
+    }
+    return best;
+}
+
+void ButtonBoxPrivate::cancelPopulation(int category)
+{
+    const int dropped = pendingItems.take(category).size();
+    if (dropped == 0)
+        return;
+
+    populationTotal -= dropped;
+    if (pendingItems.isEmpty()) {
+        populationTimer->stop();
+        populationDone = 0;
+        populationTotal = 0;
+        pendingSubItems.clear();
+        emit q_ptr->populationFinished();
+    }
+}
+
+void ButtonBoxPrivate::populateChunk()
+{
+    if (pendingItems.isEmpty())
+        return;
+
+    TraceScope trace("ButtonBox::populateChunk");
+    QElapsedTimer timer;
+    timer.start();
+
+    // At least one step per pass, so a tiny budget still makes progress.
+    // The clock is read between steps of a few buttons.
+    q_ptr->beginUpdate();
+    do {
+        const int category = nextPopulationCategory();
+        QList<ButtonBoxItem>& items = pendingItems[category];
+
+        QList<ButtonBoxItem> chunk;
+        do {
+            chunk.append(items.takeFirst());
+        } while (!items.isEmpty() && chunk.size() < 16);
+
+        addItems(category, chunk);
+        populationDone += chunk.size();
+
+        if (items.isEmpty())
+            pendingItems.remove(category);
+    } while (!pendingItems.isEmpty() && timer.elapsed() < populationBudget);
+    q_ptr->endUpdate();
+
+    emit q_ptr->populationProgress(populationDone, populationTotal);
+
+    if (!pendingItems.isEmpty()) {
+        populationTimer->start();
+        return;
+    }
+
+    // Sub-items whose parent never showed up are dropped.
+    pendingSubItems.clear();
+    populationDone = 0;
+    populationTotal = 0;
+    emit q_ptr->populationFinished();
+}
+
+QList<CategoryWidget*> ButtonBoxPrivate::layoutWidgets() const
+{
+    QList<CategoryWidget*> widgets = registry.categoryWidgets();
+    if (searchCategory)
+        widgets.prepend(searchCategory);
+    return widgets;
+}
+
+void ButtonBoxPrivate::forgetButton(int index)
+{
+    const int root = registry.record(index).parent != -1 ? registry.record(index).parent : index;
+    if (popupPages.contains(root))
+        dropPopupPage(root);
+
+    // Sub-buttons go with their root.
+    if (checkedIndex != -1 && (checkedIndex == index || registry.record(checkedIndex).parent == index))
+        setCheckedIndex(-1);
+
+    // The sub-buttons are children of the menu and go with it.
+    ToolButtonMenu* menu = registry.record(index).menu;
+    if (menu) {
+        populatedMenus.removeOne(menu);
+        menu->deleteLater();
+    }
+
+    if (filterIndex.contains(index)) {
+        filterIndex.remove(index);
+        filterSteps.clear();
+
+        QVector<int>::iterator iter = std::lower_bound(filterMatches.begin(), filterMatches.end(), index);
+        if (iter != filterMatches.end() && *iter == index)
+            filterMatches.erase(iter);
+    }
+
+    registry.removeButton(index);
+    invalidateSearch();
+}
+
+ToolButtonMenu* ButtonBoxPrivate::buttonMenu(int index)
+{
+    ButtonRegistry::ButtonRecord& record = registry.record(index);
+    if (!record.menu) {
+        record.button->setPopupMode(QToolButton::InstantPopup);
+
+        record.menu = new ToolButtonMenu(q_ptr);
+        record.menu->setOwner(record.button);
+        record.button->setMenu(record.menu);
+        connect(record.menu, SIGNAL(aboutToShow()), this, SLOT(onMenuAboutToShow()));
+    }
+    return record.menu;
+}
+
+QToolButton* ButtonBoxPrivate::createItemButton(const ButtonBoxItem& item)
+{
+    QToolButton* button = new QToolButton(q_ptr);
+    button->setObjectName(item.id);
+    button->setText(item.text);
+    button->setIconSize(itemIconSize);
+    if (item.icon.isNull() && !item.iconSource.isEmpty())
+        setIconSource(button, item.iconSource);
+    else
+        button->setIcon(item.icon);
+    button->setToolTip(item.toolTip.isEmpty() ? item.text : item.toolTip);
+    button->setCheckable(item.checkable);
+    button->setChecked(item.checked);
+    connect(button, SIGNAL(clicked()), this, SLOT(onItemClicked()));
+
+    return button;
+}
+
+void ButtonBoxPrivate::setIconSource(QToolButton* button, const QString& source)
+{
+    bool ready = false;
+    button->setIcon(IconLoader::instance()->icon(source, button->iconSize(), button->devicePixelRatioF(), &ready));
+    button->setProperty("iconSource", source);
+    if (!ready)
+        iconWaiters.insert(source, button);
+}
+
+void ButtonBoxPrivate::onIconLoaded(const QString& source)
+{
+    const QList<QPointer<QToolButton> > waiters = iconWaiters.values(source);
+    iconWaiters.remove(source);
+
+    foreach (const QPointer<QToolButton>& button, waiters) {
+        // Skip buttons deleted or given another icon in the meantime.
+        if (button && button->property("iconSource").toString() == source)
+            setIconSource(button, source);
+    }
+}
+
+void ButtonBoxPrivate::recordPopupBuild(int index, qint64 nsecs)
+{
+    if (index == -1)
+        return;
+
+    const int category = registry.record(index).category;
+    if (category != -1)
+        registry.category(category).widget->recordPopupBuild(nsecs);
+}
+
+void ButtonBoxPrivate::updateGeo()
+{
+    if (updateDepth > 0)
+        return;
+
+    TraceScope trace("ButtonBox::updateGeo");
+
+    ensureOffsets();
+    const int total = int(qMin<qint64>(categoryOffsets.total(), QWIDGETSIZE_MAX));
+    if (orient == Qt::Horizontal)
+        this->setFixedWidth(total);
+    else
+        this->setFixedHeight(total);
+}
+
+void ButtonBoxPrivate::setOrientation(Qt::Orientation o)
+{
+    if (orient != o) {
+        TraceScope trace("ButtonBox::setOrientation");
+        orient = o;
+
+        // Only the layouts are rebuilt, the categories and their buttons
+        // stay as they are.
+        delete this->layout;
+
+        if (orient == Qt::Horizontal) {
+            this->layout = new QHBoxLayout;
+            setMinimumHeight(0);
+            setMaximumHeight(QWIDGETSIZE_MAX);
+        } else {
+            this->layout = new QVBoxLayout;
+            setMinimumWidth(0);
+            setMaximumWidth(QWIDGETSIZE_MAX);
+        }
+        this->layout->setSpacing(0);
+        this->layout->setContentsMargins(0, 0, 0, 0);
+
+        foreach (CategoryWidget* cw, layoutWidgets()) {
+            cw->setOrientation(o);
+
+            this->layout->addWidget(cw);
+        }
+
+        this->setLayout(this->layout);
+        invalidateOffsets();
+        updateGeo();
+    }
+}
+
+Qt::Orientation ButtonBoxPrivate::orientation() const
+{
+    return this->orient;
+}
+
+void ButtonBoxPrivate::onExpand(bool expand)
+{
+    Q_UNUSED(expand)
+    updateGeo();
+}
+
+void ButtonBoxPrivate::onAboutToExpand()
+{
+    if (deferredCategories.isEmpty())
+        return;
+
+    CategoryWidget* cw = static_cast<CategoryWidget*>(sender());
+    const int slot = registry.categorySlot(cw->title());
+    if (deferredCategories.contains(slot) && registry.category(slot).widget == cw)
+        buildDeferred(slot);
+}
+
+void ButtonBoxPrivate::setCategoryExpanded(int slot, bool expand)
+{
+    ButtonRegistry::CategoryRecord& category = registry.category(slot);
+    category.autoCollapsed = false;
+    if (category.widget->isExpanded() == expand)
+        return;
+
+    // The first change of this event loop pass opens an update, which the
+    // queued flush closes; later changes only toggle their container.
+    if (!expansionPending) {
+        expansionPending = true;
+        q_ptr->beginUpdate();
+        QMetaObject::invokeMethod(this, "onExpansionQueued", Qt::QueuedConnection);
+    }
+
+    category.widget->setExpanded(expand, false);
+}
+
+void ButtonBoxPrivate::flushExpansion()
+{
+    if (!expansionPending)
+        return;
+
+    TraceScope trace("ButtonBox::flushExpansion");
+    expansionPending = false;
+    q_ptr->endUpdate();
+}
+
+void ButtonBoxPrivate::onExpansionQueued()
+{
+    flushExpansion();
+}
+
+void ButtonBoxPrivate::ensureOffsets()
+{
+    if (!offsetsDirty)
+        return;
+
+    offsetWidgets = layoutWidgets().toVector();
+    QVector<int> extents;
+    extents.reserve(offsetWidgets.size());
+    offsetPositions.clear();
+    foreach (const CategoryWidget* cw, offsetWidgets) {
+        offsetPositions.insert(cw, extents.size());
+        extents.append(extent(cw));
+    }
+
+    categoryOffsets.reset(extents);
+    offsetsDirty = false;
+}
+
+void ButtonBoxPrivate::onCategoryExtentChanged()
+{
+    // A category resized by the layout, as after a change of orientation,
+    // changes the total after the box updated its own size.
+    if (!geoPending) {
+        geoPending = true;
+        QMetaObject::invokeMethod(this, "flushGeo", Qt::QueuedConnection);
+    }
+
+    if (offsetsDirty)
+        return;
+
+    const CategoryWidget* cw = static_cast<CategoryWidget*>(sender());
+    const int position = offsetPositions.value(cw, -1);
+    if (position != -1)
+        categoryOffsets.setExtent(position, extent(cw));
+}
+
+void ButtonBoxPrivate::flushGeo()
+{
+    geoPending = false;
+    updateGeo();
+}
+
+int ButtonBoxPrivate::buttonOffset(int index)
+{
+    // Sub-buttons are reached through their root button.
+    while (registry.record(index).parent != -1)
+        index = registry.record(index).parent;
+
+    const ButtonRegistry::ButtonRecord& record = registry.record(index);
+    CategoryWidget* cw = registry.category(record.category).widget;
+    if (!cw->isExpanded())
+        setCategoryExpanded(record.category, true);
+    // Buttons are placed by the layout pass that closes the update.
+    flushExpansion();
+
+    ensureOffsets();
+    const QPoint pos = record.button->mapTo(cw, QPoint(0, 0));
+    return int(categoryOffsets.offset(offsetPositions.value(cw))) + (orient == Qt::Horizontal ? pos.x() : pos.y());
+}
+
+void ButtonBoxPrivate::onAnimationFrame()
+{
+    // Cheap, the animating categories only changed their fixed height.
+    updateGeo();
+}
+
+void ButtonBoxPrivate::onButtonToggled(bool toggled)
+{
     QToolButton* button = qobject_cast<QToolButton*>(sender());
+    const int index = registry.indexOf(button);
+    if (index == -1)
+        return;
+
+    trackChecked(index, toggled);
+
+    // Only root buttons with sub-buttons pop up a page.
+    const ButtonRegistry::ButtonRecord& record = registry.record(index);
+    if (!toggled || record.parent != -1 || record.subButtons.isEmpty())
+        return;
+
+    ButtonPopup* page = popupPage(index);
+
+    QPoint pos = button->mapToGlobal(button->pos());
+    qCDebug(lcButtonBox) << "sub-button popup at" << pos;
+
+    // Remove focus from this widget, preventing the focus rect
+    // from showing when the popup is shown. Order an update to
+    // make sure the focus rect is cleared.
+    clearFocus();
+    update();
+
+    page->popup(pos);
+}
+
+int ButtonBoxPrivate::categoryOf(int index) const
+{
+    const ButtonRegistry::ButtonRecord& record = registry.record(index);
+    return record.parent != -1 ? registry.record(record.parent).category : record.category;
+}
+
+void ButtonBoxPrivate::setExclusive(bool on)
+{
+    if (exclusive == on)
+        return;
+
+    exclusive = on;
+    if (!exclusive) {
+        setCheckedIndex(-1);
+        return;
+    }
+
+    // Restored checked buttons not built yet are needed now.
+    foreach (int category, deferredCategories.keys()) {
+        if (deferredCategories.value(category).hasChecked())
+            buildDeferred(category);
+    }
+
+    // The only scan, in record order: the first checked button stays and
+    // the others uncheck, which trackChecked() ignores for them.
+    for (int i = 0; i < registry.buttonSlots(); ++i) {
+        QToolButton* button = registry.record(i).button;
+        if (!button || !button->isChecked())
+            continue;
+
+        if (checkedIndex == -1)
+            setCheckedIndex(i);
+        else
+            button->setChecked(false);
+    }
+}
+
+void ButtonBoxPrivate::setCheckedIndex(int index)
+{
+    if (checkedIndex == index)
+        return;
+
+    if (checkedIndex != -1) {
+        const int slot = categoryOf(checkedIndex);
+        if (slot != -1)
+            registry.category(slot).checkedButton = -1;
+    }
+
+    checkedIndex = index;
+    if (checkedIndex != -1) {
+        const int slot = categoryOf(checkedIndex);
+        if (slot != -1)
+            registry.category(slot).checkedButton = checkedIndex;
+    }
+
+    emit q_ptr->checkedButtonChanged(index != -1 ? registry.record(index).button : nullptr);
+}
+
+void ButtonBoxPrivate::trackChecked(int index, bool checked)
+{
+    if (!exclusive)
+        return;
+
+    if (checked) {
+        if (index == checkedIndex)
+            return;
+
+        const int previous = checkedIndex;
+        setCheckedIndex(index);
+        if (previous != -1)
+            registry.record(previous).button->setChecked(false);
+    } else if (index == checkedIndex) {
+        // Like a radio button, the checked one stays checked until another is.
+        registry.record(index).button->setChecked(true);
+    }
+}
+
+void ButtonBoxPrivate::onMenuAboutToShow()
+{
+    // The menu needs its sub-buttons back, the page is built again later.
+    ToolButtonMenu* menu = static_cast<ToolButtonMenu*>(sender());
+    const int index = registry.indexOf(menu->owner());
+    if (popupPages.contains(index))
+        dropPopupPage(index);
+}
+
+ButtonPopup* ButtonBoxPrivate::popupPage(int index)
+{
+    ButtonPopup* page = popupPages.value(index);
+    if (page && !page->isComplete()) {
+        dropPopupPage(index);
+        page = nullptr;
+    }
+
+    popupOrder.removeOne(index);
+    popupOrder.prepend(index);
+    if (page)
+        return page;
+
+    TraceScope trace("ButtonPopup::build");
+    QElapsedTimer timer;
+    timer.start();
+
+    page = new ButtonPopup;
+    foreach (int subButton, registry.record(index).subButtons)
+        page->addButton(registry.record(subButton).button);
+
+    // No wider than the screen the box is on.
+    QScreen* screen = QGuiApplication::screenAt(q_ptr->mapToGlobal(q_ptr->rect().center()));
+    if (!screen)
+        screen = QGuiApplication::primaryScreen();
+    page->updatePageSize(screen->availableGeometry().width());
+    popupPages.insert(index, page);
+    recordPopupBuild(index, timer.nsecsElapsed());
+
+    trimPopupPages();
+    return page;
+}
+
+void ButtonBoxPrivate::dropPopupPage(int index)
+{
+    ButtonPopup* page = popupPages.take(index);
+    popupOrder.removeOne(index);
+    if (!page)
+        return;
+
+    page->hide();
+    page->clear();
+    ToolButtonMenu* menu = registry.record(index).menu;
+    if (menu)
+        menu->reclaimButtons();
+    page->deleteLater();
+}
+
+void ButtonBoxPrivate::trimPopupPages()
+{
+    while (popupOrder.size() > popupPageLimit)
+        dropPopupPage(popupOrder.last());
+}
+
+void ButtonBoxPrivate::onButtonDestroyed(QObject* object)
+{
+    // Deleted behind our back; only the pointer value is used here.
+    const int index = registry.indexOf(object);
+    if (index == -1)
+        return;
+
+    const int category = registry.record(index).category;
+    if (category != -1)
+        registry.category(category).widget->removeButton(static_cast<QToolButton*>(object));
+
+    forgetButton(index);
+}
+
+void ButtonBoxPrivate::onItemClicked()
+{
+    emit q_ptr->itemTriggered(sender()->objectName());
+}
+
+void ButtonBoxPrivate::onProviderMenuAboutToShow()
+{
+    // The menu populated itself in its own aboutToShow() handler, which
+    // was connected first; only the recency bookkeeping is left here.
+    ToolButtonMenu* menu = qobject_cast<ToolButtonMenu*>(sender());
+    if (!menu->isPopulated())
+        return;
+
+    const qint64 nsecs = menu->takeBuildNsecs();
+    if (nsecs >= 0)
+        recordPopupBuild(registry.indexOf(menu->owner()), nsecs);
+
+    populatedMenus.removeOne(menu);
+    populatedMenus.prepend(menu);
+
+    if (populatedMenuLimit > 0) {
+        while (populatedMenus.size() > populatedMenuLimit)
+            populatedMenus.takeLast()->release();
+    }
+}
+
+/////////////////////////////////////
+/// The ButtonBox class
+/////////////////////////////////////
+ButtonBox::ButtonBox(QWidget* parent) : QScrollArea(parent)
+{
+    d_ptr = new ButtonBoxPrivate(this);
+    this->setContentsMargins(0, 0, 0, 0);
+//    setMaximumWidth(300);
+    setMinimumWidth(120);
+
+    setWidget(d_ptr);
+    setWidgetResizable(true);
+}
+
+ButtonBox::~ButtonBox()
+{
+    // Pages are top level popups, not children of the box. Dropping them
+    // hands their sub-buttons back to the menus first.
+    foreach (int index, d_ptr->popupPages.keys())
+        d_ptr->dropPopupPage(index);
+    delete d_ptr;
+}
+
+QMenu* createMenu()
+{
+    QMenu* menu = new QMenu();
+    QAction* act1 = new QAction();
+    act1->setText("Action 1");
+    menu->addAction(act1);
+
+    QAction* act2 = new QAction();
+    act2->setText("Action 2");
+    menu->addAction(act2);
+
+    QAction* act3 = new QAction();
+    act3->setText("Action 3");
+    menu->addAction(act3);
+
+    return menu;
+}
+
+void ButtonBox::beginUpdate()
+{
+    if (d_ptr->updateDepth++ > 0)
+        return;
+
+    d_ptr->setUpdatesEnabled(false);
+    d_ptr->layout->setEnabled(false);
+
+    foreach (CategoryWidget* cw, d_ptr->layoutWidgets())
+        cw->setUpdatesSuspended(true);
+}
+
+void ButtonBox::endUpdate()
+{
+    Q_ASSERT_X(d_ptr->updateDepth > 0, "endUpdate", "endUpdate() without matching beginUpdate()");
+    if (d_ptr->updateDepth <= 0 || --d_ptr->updateDepth > 0)
+        return;
+
+    TraceScope trace("ButtonBox::endUpdate");
+
+    const QList<CategoryWidget*> categoryWidgets = d_ptr->layoutWidgets();
+    foreach (CategoryWidget* cw, categoryWidgets)
+        cw->setUpdatesSuspended(false);
+
+    d_ptr->layout->setEnabled(true);
+    d_ptr->layout->activate();
+
+    foreach (CategoryWidget* cw, categoryWidgets)
+        cw->updateGeo();
+
+    d_ptr->updateGeo();
+    d_ptr->setUpdatesEnabled(true);
+}
+
+QByteArray ButtonBox::saveState() const
+{
+    if (d_ptr->viewMode != WidgetView)
+        return QByteArray();
+
+    // Strings are written once, in a table, and referred to by position.
+    QStringList strings;
+    QHash<QString, quint32> stringIndex;
+    auto ref = [&](const QString& string) -> quint32 {
+        auto iter = stringIndex.constFind(string);
+        if (iter != stringIndex.constEnd())
+            return iter.value();
+        strings.append(string);
+        return stringIndex.insert(string, strings.size() - 1).value();
+    };
+
+    QByteArray body;
+    QDataStream stream(&body, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    auto writeItem = [&](const ButtonBoxItem& item) {
+        stream << ref(item.id) << ref(item.text) << ref(item.toolTip) << ref(item.iconSource)
+               << quint8((item.checkable ? 1 : 0) | (item.checked ? 2 : 0));
+    };
+
+    const ButtonRegistry& registry = d_ptr->registry;
+    stream << quint32(registry.categoryCount());
+    for (int i = 0; i < registry.categoryCount(); ++i) {
+        const int slot = registry.categorySlotAt(i);
+        const ButtonRegistry::CategoryRecord& category = registry.category(slot);
+
+        // Built buttons, then those restored but not built, then those
+        // still queued for population.
+        QList<ButtonBoxItem> roots;
+        QHash<QString, QList<ButtonBoxItem> > subItems;
+        foreach (QToolButton* button, category.widget->buttons()) {
+            const int index = registry.indexOf(button);
+            if (index == -1)
+                continue;
+
+            const ButtonBoxItem root = d_ptr->buttonItem(index);
+            roots.append(root);
+            foreach (int subButton, registry.record(index).subButtons)
+                subItems[root.id].append(d_ptr->buttonItem(subButton));
+        }
+
+        const ButtonBoxPrivate::DeferredCategory deferred = d_ptr->deferredCategories.value(slot);
+        roots += deferred.items;
+        for (auto iter = deferred.subItems.constBegin(); iter != deferred.subItems.constEnd(); ++iter)
+            subItems[iter.key()] += iter.value();
+
+        foreach (const ButtonBoxItem& item, d_ptr->pendingItems.value(slot)) {
+            roots.append(item);
+            subItems[item.id] += d_ptr->pendingSubItems.value(item.id);
+        }
+
+        const bool expanded = !d_ptr->deferredCategories.contains(slot)
+                && (category.widget->isExpanded() || category.autoCollapsed);
+        stream << ref(category.title) << quint8(expanded ? 1 : 0) << quint32(roots.size());
+        foreach (const ButtonBoxItem& root, roots) {
+            writeItem(root);
+            const QList<ButtonBoxItem> subs = subItems.value(root.id);
+            stream << quint32(subs.size());
+            foreach (const ButtonBoxItem& sub, subs)
+                writeItem(sub);
+        }
+    }
 
-    buttonPopup->clear();
-    QToolButtonList buttonList = this->button2SubButtonsMap.value(button);
-    buttonPopup->addButtons(buttonList);
+    stream << qint32(horizontalScrollBar()->value()) << qint32(verticalScrollBar()->value());
 
-    // layout
-    const QRect desktop = QApplication::desktop()->geometry();
-    // Make sure the popup is inside the desktop.
+    QByteArray state;
+    QDataStream header(&state, QIODevice::WriteOnly);
+    header.setVersion(QDataStream::Qt_5_6);
+    header << StateMagic << StateVersion << quint32(strings.size());
+    foreach (const QString& string, strings)
+        header << string;
+    header.writeRawData(body.constData(), body.size());
+    return state;
+}
 
-    QPoint pos = button->mapToGlobal(button->pos());
-    qDebug() << "gpos: " << pos;
-    if (pos.x() < desktop.left())
-        pos.setX(desktop.left());
-    if (pos.y() < desktop.top())
-        pos.setY(desktop.top());
-
-    if ((pos.x() + buttonPopup->sizeHint().width()) > desktop.width())
-        pos.setX(desktop.width() - buttonPopup->sizeHint().width());
-    if ((pos.y() + buttonPopup->sizeHint().height()) > desktop.bottom())
-        pos.setY(desktop.bottom() - buttonPopup->sizeHint().height());
-    buttonPopup->move(pos);
+bool ButtonBox::restoreState(const QByteArray& state)
+{
+    if (d_ptr->viewMode != WidgetView)
+        return false;
 
-    // Remove focus from this widget, preventing the focus rect
-    // from showing when the popup is shown. Order an update to
-    // make sure the focus rect is cleared.
-    clearFocus();
-    update();
+    TraceScope trace("ButtonBox::restoreState");
 
-    // Allow keyboard navigation as soon as the popup shows.
-    buttonPopup->setFocus();
+    QDataStream stream(state);
+    stream.setVersion(QDataStream::Qt_5_6);
 
-    // Execute the popup. The popup will enter the event loop.
-    buttonPopup->show();
+    quint32 magic, version, stringCount;
+    stream >> magic >> version >> stringCount;
+    if (stream.status() != QDataStream::Ok || magic != StateMagic || version != StateVersion)
+        return false;
+
+    QVector<QString> strings;
+    strings.reserve(int(qMin<quint32>(stringCount, quint32(state.size()))));
+    for (quint32 i = 0; i < stringCount && stream.status() == QDataStream::Ok; ++i) {
+        QString string;
+        stream >> string;
+        strings.append(string);
+    }
+
+    auto readItem = [&]() {
+        quint32 id, text, toolTip, iconSource;
+        quint8 flags;
+        stream >> id >> text >> toolTip >> iconSource >> flags;
+
+        ButtonBoxItem item;
+        item.id = strings.value(int(id));
+        item.text = strings.value(int(text));
+        item.toolTip = strings.value(int(toolTip));
+        item.iconSource = strings.value(int(iconSource));
+        item.checkable = flags & 1;
+        item.checked = flags & 2;
+        return item;
+    };
+
+    // Read everything first, a corrupt state leaves the box untouched.
+    struct Category
+    {
+        QString title;
+        bool expanded;
+        ButtonBoxPrivate::DeferredCategory content;
+    };
+    QVector<Category> categories;
+
+    quint32 categoryCount;
+    stream >> categoryCount;
+    for (quint32 i = 0; i < categoryCount && stream.status() == QDataStream::Ok; ++i) {
+        quint32 title, rootCount;
+        quint8 expanded;
+        stream >> title >> expanded >> rootCount;
+
+        Category category;
+        category.title = strings.value(int(title));
+        category.expanded = expanded;
+        for (quint32 r = 0; r < rootCount && stream.status() == QDataStream::Ok; ++r) {
+            const ButtonBoxItem root = readItem();
+            category.content.items.append(root);
+
+            quint32 subCount;
+            stream >> subCount;
+            for (quint32 s = 0; s < subCount && stream.status() == QDataStream::Ok; ++s)
+                category.content.subItems[root.id].append(readItem());
+        }
+        categories.append(category);
+    }
+
+    qint32 scrollX, scrollY;
+    stream >> scrollX >> scrollY;
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    beginUpdate();
+    clear();
+    foreach (const Category& category, categories) {
+        const int slot = d_ptr->categorySlot(category.title);
+        d_ptr->deferCategory(slot, category.content);
+        // Exclusive mode must see every checked button, even collapsed.
+        if (category.expanded || (d_ptr->exclusive && category.content.hasChecked()))
+            d_ptr->buildDeferred(slot);
+        if (!category.expanded)
+            d_ptr->registry.category(slot).widget->setExpanded(false, false);
+    }
+    endUpdate();
+
+    horizontalScrollBar()->setValue(scrollX);
+    verticalScrollBar()->setValue(scrollY);
+    if (!isVisible())
+        d_ptr->restoredScrollPosition = QPoint(scrollX, scrollY);
+    return true;
 }
 
-/////////////////////////////////////
-/// The ButtonBox class
-/////////////////////////////////////
-ButtonBox::ButtonBox(QWidget* parent) : QScrollArea(parent)
+bool ButtonBox::saveState(const QString& fileName) const
 {
-    d_ptr = new ButtonBoxPrivate(this);
-    this->setContentsMargins(0, 0, 0, 0);
-//    setMaximumWidth(300);
-    setMinimumWidth(120);
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    const QByteArray state = saveState();
+    if (state.isEmpty())
+        return false;
+    return file.write(state) == state.size() && file.commit();
+}
 
-    setWidget(d_ptr);
-    setWidgetResizable(true);
+bool ButtonBox::restoreState(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0)
+        return false;
+
+    uchar* data = file.map(0, file.size());
+    if (!data)
+        return false;
+
+    // Read in place, every string is copied out while parsing.
+    const bool restored = restoreState(QByteArray::fromRawData(reinterpret_cast<const char*>(data), int(file.size())));
+    file.unmap(data);
+    return restored;
 }
 
-ButtonBox::~ButtonBox()
+void ButtonBox::setAnimationDuration(int msecs)
 {
-    delete d_ptr;
+    d_ptr->animationDuration = qMax(0, msecs);
+    foreach (CategoryWidget* cw, d_ptr->layoutWidgets())
+        cw->setAnimationDuration(d_ptr->animationDuration);
 }
 
-QMenu* createMenu()
+int ButtonBox::animationDuration() const
 {
-    QMenu* menu = new QMenu();
-    QAction* act1 = new QAction();
-    act1->setText("Action 1");
-    menu->addAction(act1);
+    return d_ptr->animationDuration;
+}
 
-    QAction* act2 = new QAction();
-    act2->setText("Action 2");
-    menu->addAction(act2);
+void ButtonBox::setPopulationBudget(int msecs)
+{
+    d_ptr->populationBudget = qMax(0, msecs);
+}
 
-    QAction* act3 = new QAction();
-    act3->setText("Action 3");
-    menu->addAction(act3);
+int ButtonBox::populationBudget() const
+{
+    return d_ptr->populationBudget;
+}
 
-    return menu;
+bool ButtonBox::isPopulating() const
+{
+    return !d_ptr->pendingItems.isEmpty();
 }
 
-void ButtonBox::addButton(const QString& category, QToolButton* button)
+void ButtonBox::setViewMode(ViewMode mode)
 {
-    if (!d_ptr->categoryWidgetMap.contains(category)) {
-        CategoryWidget* cw = new CategoryWidget(this);
-        cw->setTitle(category);
-        d_ptr->categoryWidgetMap.insert(category, cw);
-        cw->addButton(button);
-        d_ptr->layout->addWidget(cw);
-        connect(cw, SIGNAL(expanded(bool)), d_ptr, SLOT(onExpand(bool)));
+    if (d_ptr->viewMode == mode)
+        return;
+
+    const ViewMode oldMode = d_ptr->viewMode;
+    d_ptr->viewMode = mode;
+    if (mode != WidgetView) {
+        if (!d_ptr->virtualView) {
+            d_ptr->virtualView = new VirtualButtonView(verticalScrollBar(), viewport());
+            d_ptr->virtualView->setIconSize(d_ptr->itemIconSize);
+            connect(d_ptr->virtualView, SIGNAL(itemTriggered(QString)), this, SIGNAL(itemTriggered(QString)));
+        }
+        d_ptr->virtualView->setPainted(mode == PaintedView);
+
+        if (oldMode == WidgetView) {
+            // The widget tree stays alive, it is only detached from the scroll area.
+            takeWidget();
+            setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+            setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+            d_ptr->virtualView->resize(viewport()->size());
+            d_ptr->virtualView->show();
+        }
     } else {
-        CategoryWidget* cw = qobject_cast<CategoryWidget*>(d_ptr->categoryWidgetMap.value(category));
-        cw->addButton(button);
+        d_ptr->virtualView->hide();
+        setWidget(d_ptr);
+        setWidgetResizable(true);
+        setOrientation(d_ptr->orientation());
+    }
+}
+
+ButtonBox::ViewMode ButtonBox::viewMode() const
+{
+    return d_ptr->viewMode;
+}
+
+void ButtonBox::setItemIconSize(const QSize& size)
+{
+    d_ptr->itemIconSize = size;
+    if (d_ptr->virtualView)
+        d_ptr->virtualView->setIconSize(size);
+}
+
+QSize ButtonBox::itemIconSize() const
+{
+    return d_ptr->itemIconSize;
+}
+
+bool ButtonBox::saveIconAtlas(const QString& fileName)
+{
+    return IconCache::instance()->saveAtlas(fileName);
+}
+
+bool ButtonBox::loadIconAtlas(const QString& fileName)
+{
+    return IconCache::instance()->openAtlas(fileName);
+}
+
+void ButtonBox::setButtonIconSource(QToolButton* button, const QString& source)
+{
+    if (button)
+        d_ptr->setIconSource(button, source);
+}
+
+void ButtonBox::addItem(const QString& category, const ButtonBoxItem& item)
+{
+    if (d_ptr->viewMode != WidgetView)
+        d_ptr->virtualView->addItem(category, item);
+    else
+        addButton(category, d_ptr->createItemButton(item));
+}
+
+void ButtonBox::addSubItem(const QString& parentId, const ButtonBoxItem& item)
+{
+    if (d_ptr->viewMode != WidgetView) {
+        d_ptr->virtualView->addSubItem(parentId, item);
+    } else if (d_ptr->deferredIds.contains(parentId)) {
+        // The parent is restored but not built yet, the item waits with it.
+        const int slot = d_ptr->deferredIds.value(parentId);
+        d_ptr->deferredCategories[slot].subItems[parentId].append(item);
+        d_ptr->deferredIds.insert(item.id, slot);
+    } else if (QToolButton* parent = button(parentId)) {
+        addSubButton(parent, d_ptr->createItemButton(item));
+    } else if (isPopulating()) {
+        // The parent may still be queued, the item is dropped if it is not.
+        d_ptr->pendingSubItems[parentId].append(item);
+    } else {
+        qCWarning(lcButtonBox) << "addSubItem: no item" << parentId << "to add" << item.id << "to";
+    }
+}
+
+void ButtonBox::addItemsAsync(const QString& category, const QList<ButtonBoxItem>& items)
+{
+    if (items.isEmpty())
+        return;
+
+    if (d_ptr->viewMode != WidgetView) {
+        foreach (const ButtonBoxItem& item, items)
+            d_ptr->virtualView->addItem(category, item);
+        return;
     }
 
-    disconnect(button, SIGNAL(toggled(bool)), d_ptr, SLOT(onButtonToggled(bool)));
-    connect(button, SIGNAL(toggled(bool)), d_ptr, SLOT(onButtonToggled(bool)));
+    // The category shows up right away, its buttons as they are made.
+    const int slot = d_ptr->categorySlot(category);
+    d_ptr->pendingItems[slot] += items;
+    d_ptr->populationTotal += items.size();
+    d_ptr->schedulePopulation();
+}
+
+QString ButtonBox::buttonId(QToolButton* button) const
+{
+    const int index = d_ptr->registry.indexOf(button);
+    return index != -1 ? d_ptr->registry.record(index).id : QString();
+}
+
+QToolButton* ButtonBox::button(const QString& id) const
+{
+    // A restored button not built yet is built with its category.
+    const int deferred = d_ptr->deferredIds.value(id, -1);
+    if (deferred != -1)
+        d_ptr->buildDeferred(deferred);
+
+    const int index = d_ptr->registry.indexOf(id);
+    return index != -1 ? d_ptr->registry.record(index).button : nullptr;
+}
+
+void ButtonBox::addButton(const QString& category, QToolButton* button)
+{
+    insertButton(category, -1, button);
+}
+
+void ButtonBox::insertButton(const QString& category, int index, QToolButton* button)
+{
+    const int slot = d_ptr->categorySlot(category);
+    d_ptr->registry.category(slot).widget->insertButton(index, button);
+    d_ptr->addRootButton(button, slot);
+}
+
+void ButtonBox::addButtons(const QString& category, const QList<QToolButton*>& buttons)
+{
+    if (buttons.isEmpty())
+        return;
+
+    beginUpdate();
 
-    d_ptr->rootButtons.append(button);
+    const int slot = d_ptr->categorySlot(category);
+    CategoryWidget* cw = d_ptr->registry.category(slot).widget;
+    foreach (QToolButton* button, buttons) {
+        cw->addButton(button);
+        d_ptr->addRootButton(button, slot);
+    }
+
+    endUpdate();
 }
 
 void ButtonBox::addSubButton(QToolButton* button, QToolButton* subButton)
+{
+    insertSubButton(button, -1, subButton);
+}
+
+void ButtonBox::insertSubButton(QToolButton* button, int index, QToolButton* subButton)
 {
 
     if (!button || !subButton)
         return;
 
-    Q_ASSERT_X(d_ptr->rootButtons.contains(button), "addSubButton" , "trying to add button to non-root button");
+    Q_ASSERT_X(d_ptr->registry.isRoot(button), "addSubButton" , "trying to add button to non-root button");
+
+    const int root = d_ptr->registry.indexOf(button);
+    if (root == -1)
+        return;
+
+    if (d_ptr->popupPages.contains(root))
+        d_ptr->dropPopupPage(root);
+    d_ptr->buttonMenu(root)->insertButton(index, subButton);
+    const int record = d_ptr->registry.addButton(subButton, -1, root, index);
+    d_ptr->invalidateSearch();
+    connect(subButton, SIGNAL(toggled(bool)), d_ptr, SLOT(onButtonToggled(bool)), Qt::UniqueConnection);
+    connect(subButton, SIGNAL(destroyed(QObject*)), d_ptr, SLOT(onButtonDestroyed(QObject*)), Qt::UniqueConnection);
+    d_ptr->trackChecked(record, subButton->isChecked());
+}
+
+void ButtonBox::setSubButtonProvider(QToolButton* button, const SubButtonProvider& provider)
+{
+    if (!button)
+        return;
+
+    Q_ASSERT_X(d_ptr->registry.isRoot(button), "setSubButtonProvider" , "trying to set provider on non-root button");
+
+    const int root = d_ptr->registry.indexOf(button);
+    if (root == -1)
+        return;
+
+    ToolButtonMenu* menu = d_ptr->buttonMenu(root);
+    d_ptr->populatedMenus.removeOne(menu);
+    menu->setProvider(button, provider);
+    connect(menu, SIGNAL(aboutToShow()), d_ptr, SLOT(onProviderMenuAboutToShow()), Qt::UniqueConnection);
+}
+
+void ButtonBox::setPopulatedMenuLimit(int limit)
+{
+    d_ptr->populatedMenuLimit = limit;
+    if (limit > 0) {
+        while (d_ptr->populatedMenus.size() > limit)
+            d_ptr->populatedMenus.takeLast()->release();
+    }
+}
+
+int ButtonBox::populatedMenuLimit() const
+{
+    return d_ptr->populatedMenuLimit;
+}
+
+QHash<QString, ButtonBoxStatistics> ButtonBox::statistics() const
+{
+    QHash<QString, ButtonBoxStatistics> statistics;
+    foreach (CategoryWidget* cw, d_ptr->registry.categoryWidgets())
+        statistics.insert(cw->title(), cw->statistics());
+    return statistics;
+}
+
+void ButtonBox::resetStatistics()
+{
+    foreach (CategoryWidget* cw, d_ptr->registry.categoryWidgets())
+        cw->resetStatistics();
+}
+
+void ButtonBox::setFilterText(const QString& text)
+{
+    d_ptr->setFilterText(text);
+}
+
+QString ButtonBox::filterText() const
+{
+    return d_ptr->filterText;
+}
+
+void ButtonBox::setSearchText(const QString& text)
+{
+    d_ptr->setSearchText(text);
+}
+
+QString ButtonBox::searchText() const
+{
+    return d_ptr->searchText;
+}
+
+void ButtonBox::setSearchResultLimit(int limit)
+{
+    if (d_ptr->searchResultLimit == limit)
+        return;
+
+    d_ptr->searchResultLimit = qMax(0, limit);
+    if (!d_ptr->searchText.isEmpty())
+        d_ptr->runSearch();
+}
+
+int ButtonBox::searchResultLimit() const
+{
+    return d_ptr->searchResultLimit;
+}
+
+void ButtonBox::updateFilterIndex(QToolButton* button)
+{
+    const int index = d_ptr->registry.indexOf(button);
+    if (index == -1)
+        return;
+
+    d_ptr->registry.updateId(index);
+    if (d_ptr->registry.record(index).category != -1)
+        d_ptr->indexButton(index);
+    else
+        d_ptr->invalidateSearch();
+}
+
+QStringList ButtonBox::categories() const
+{
+    QStringList titles;
+    for (int i = 0; i < d_ptr->registry.categoryCount(); ++i)
+        titles.append(d_ptr->registry.category(d_ptr->registry.categorySlotAt(i)).title);
+    return titles;
+}
+
+void ButtonBox::insertCategory(int index, const QString& category)
+{
+    d_ptr->categorySlot(category, index);
+}
+
+void ButtonBox::renameCategory(const QString& category, const QString& title)
+{
+    const int slot = d_ptr->registry.categorySlot(category);
+    if (slot == -1 || category == title || d_ptr->registry.categorySlot(title) != -1)
+        return;
+
+    d_ptr->registry.category(slot).widget->setTitle(title);
+    d_ptr->registry.renameCategory(slot, title);
+}
+
+void ButtonBox::removeCategory(const QString& category)
+{
+    const int slot = d_ptr->registry.categorySlot(category);
+    if (slot == -1)
+        return;
+
+    d_ptr->cancelPopulation(slot);
+    d_ptr->takeDeferred(slot);
+
+    CategoryWidget* cw = d_ptr->registry.category(slot).widget;
+    foreach (QToolButton* button, cw->buttons()) {
+        const int index = d_ptr->registry.indexOf(button);
+        if (index != -1)
+            d_ptr->forgetButton(index);
+    }
+    d_ptr->registry.removeCategory(slot);
+    d_ptr->invalidateOffsets();
+
+    d_ptr->layout->removeWidget(cw);
+    cw->hide();
+    cw->deleteLater();
+
+    d_ptr->updateGeo();
+}
 
-    if (!d_ptr->button2MenuMap.contains(button)) {
-        button->setPopupMode(QToolButton::InstantPopup);
+void ButtonBox::removeButton(QToolButton* button)
+{
+    if (!button)
+        return;
 
-        ToolButtonMenu* btm = new ToolButtonMenu(this);
-        btm->addButton(subButton);
-        button->setMenu(btm);
-        d_ptr->button2MenuMap.insert(button, btm);
+    const int index = d_ptr->registry.indexOf(button);
+    if (index != -1) {
+        const ButtonRegistry::ButtonRecord& record = d_ptr->registry.record(index);
+        if (record.category != -1) {
+            d_ptr->registry.category(record.category).widget->removeButton(button);
+        } else {
+            // Back in the menu first, the page would take it along.
+            d_ptr->dropPopupPage(record.parent);
+            ToolButtonMenu* menu = d_ptr->registry.record(record.parent).menu;
+            if (menu)
+                menu->removeButton(button);
+        }
+        d_ptr->forgetButton(index);
     } else {
-        ToolButtonMenu* menu = d_ptr->button2MenuMap[button];
-        menu->addButton(subButton);
+        // Provider created sub-buttons are not registered.
+        ToolButtonMenu* menu = qobject_cast<ToolButtonMenu*>(button->parentWidget());
+        if (menu)
+            menu->removeButton(button);
     }
+
+    button->hide();
+    button->deleteLater();
 }
 
-void ButtonBox::expandAll()
+void ButtonBox::clear()
+{
+    beginUpdate();
+    foreach (const QString& category, categories())
+        removeCategory(category);
+    endUpdate();
+}
+
+void ButtonBox::setModel(QAbstractItemModel* model)
 {
-    QWidgetList categoryWidgets = d_ptr->categoryWidgetMap.values();
-    foreach (QWidget* widget, categoryWidgets) {
-        CategoryWidget* cw = qobject_cast<CategoryWidget*>(widget);
-        cw->expand(true);
+    if (!d_ptr->modelAdapter) {
+        d_ptr->modelAdapter = new ModelAdapter(this);
+        connect(d_ptr->modelAdapter, SIGNAL(itemTriggered(QString)), this, SIGNAL(itemTriggered(QString)));
+        connect(d_ptr->modelAdapter, SIGNAL(indexTriggered(QModelIndex)), this, SIGNAL(indexTriggered(QModelIndex)));
     }
+
+    d_ptr->modelAdapter->setModel(model);
+}
+
+QAbstractItemModel* ButtonBox::model() const
+{
+    return d_ptr->modelAdapter ? d_ptr->modelAdapter->model() : nullptr;
+}
+
+PaletteLoader* ButtonBox::loadPalette(const QString& fileName)
+{
+    if (!d_ptr->paletteLoader)
+        d_ptr->paletteLoader = new PaletteLoader(this);
+
+    return d_ptr->paletteLoader->load(fileName) ? d_ptr->paletteLoader : nullptr;
+}
+
+void ButtonBox::expandAll()
+{
+    if (d_ptr->virtualView)
+        d_ptr->virtualView->setAllExpanded(true);
+
+    QSet<QString> all;
+    all.reserve(d_ptr->registry.categoryCount());
+    for (int i = 0; i < d_ptr->registry.categoryCount(); ++i)
+        all.insert(d_ptr->registry.category(d_ptr->registry.categorySlotAt(i)).title);
+    setExpandedCategories(all);
 }
 
 void ButtonBox::collapseAll()
 {
-    QWidgetList categoryWidgets = d_ptr->categoryWidgetMap.values();
-    foreach (QWidget* widget, categoryWidgets) {
-        CategoryWidget* cw = qobject_cast<CategoryWidget*>(widget);
-        cw->expand(false);
+    if (d_ptr->virtualView)
+        d_ptr->virtualView->setAllExpanded(false);
+
+    setExpandedCategories(QSet<QString>());
+}
+
+void ButtonBox::setExpanded(const QString& category, bool expanded)
+{
+    const int slot = d_ptr->registry.categorySlot(category);
+    if (slot != -1)
+        d_ptr->setCategoryExpanded(slot, expanded);
+}
+
+bool ButtonBox::isExpanded(const QString& category) const
+{
+    const int slot = d_ptr->registry.categorySlot(category);
+    return slot != -1 && d_ptr->registry.category(slot).widget->isExpanded();
+}
+
+void ButtonBox::setExpandedCategories(const QSet<QString>& categories)
+{
+    // Already one batch, laid out right away instead of in the next pass.
+    beginUpdate();
+    for (int i = 0; i < d_ptr->registry.categoryCount(); ++i) {
+        const int slot = d_ptr->registry.categorySlotAt(i);
+        d_ptr->setCategoryExpanded(slot, categories.contains(d_ptr->registry.category(slot).title));
+    }
+    d_ptr->flushExpansion();
+    endUpdate();
+}
+
+void ButtonBox::scrollToCategory(const QString& category)
+{
+    const int slot = d_ptr->registry.categorySlot(category);
+    if (slot == -1 || d_ptr->viewMode != WidgetView)
+        return;
+
+    // Extents of pending expansion changes are known after their layout.
+    d_ptr->flushExpansion();
+    d_ptr->ensureOffsets();
+    const int position = d_ptr->offsetPositions.value(d_ptr->registry.category(slot).widget);
+    const int offset = int(d_ptr->categoryOffsets.offset(position));
+    if (orientation() == Qt::Horizontal)
+        horizontalScrollBar()->setValue(offset);
+    else
+        verticalScrollBar()->setValue(offset);
+}
+
+void ButtonBox::scrollToButton(QToolButton* button)
+{
+    const int index = d_ptr->registry.indexOf(button);
+    if (index == -1 || d_ptr->viewMode != WidgetView)
+        return;
+
+    const int offset = d_ptr->buttonOffset(index);
+    QToolButton* target = d_ptr->registry.record(index).button;
+    if (orientation() == Qt::Horizontal) {
+        const int width = target->width();
+        ensureVisible(offset + width / 2, 0, width / 2, 0);
+    } else {
+        const int height = target->height();
+        ensureVisible(0, offset + height / 2, 0, height / 2 + CategoryHeader::Height);
+    }
+}
+
+QString ButtonBox::categoryAt(int pos) const
+{
+    if (d_ptr->viewMode != WidgetView)
+        return QString();
+
+    d_ptr->flushExpansion();
+    d_ptr->ensureOffsets();
+    const QScrollBar* scrollBar = orientation() == Qt::Horizontal ? horizontalScrollBar() : verticalScrollBar();
+    const int position = d_ptr->categoryOffsets.indexAt(qint64(pos) + scrollBar->value());
+    if (position == -1)
+        return QString();
+
+    return d_ptr->offsetWidgets.at(position)->title();
+}
+
+QSet<QString> ButtonBox::expandedCategories() const
+{
+    QSet<QString> expanded;
+    for (int i = 0; i < d_ptr->registry.categoryCount(); ++i) {
+        const ButtonRegistry::CategoryRecord& category = d_ptr->registry.category(d_ptr->registry.categorySlotAt(i));
+        if (category.widget->isExpanded())
+            expanded.insert(category.title);
     }
+    return expanded;
 }
 
 void ButtonBox::setOrientation(Qt::Orientation o)
 {
+    if (d_ptr->viewMode != WidgetView) {
+        // The virtual view only scrolls vertically, the orientation is
+        // applied once the widget view is back.
+        d_ptr->setOrientation(o);
+        return;
+    }
+
     if (o == Qt::Horizontal) {
         setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
         setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
@@ -670,13 +3840,27 @@ Qt::Orientation ButtonBox::orientation() const
 
 void ButtonBox::setExclusive(bool exclusive)
 {
-    // TODO
+    d_ptr->setExclusive(exclusive);
 }
 
 bool ButtonBox::isExclusive() const
 {
-    // TODO
-    return false;
+    return d_ptr->exclusive;
+}
+
+QToolButton* ButtonBox::checkedButton() const
+{
+    return d_ptr->checkedIndex != -1 ? d_ptr->registry.record(d_ptr->checkedIndex).button : nullptr;
+}
+
+QToolButton* ButtonBox::checkedButton(const QString& category) const
+{
+    const int slot = d_ptr->registry.categorySlot(category);
+    if (slot == -1)
+        return nullptr;
+
+    const int index = d_ptr->registry.category(slot).checkedButton;
+    return index != -1 ? d_ptr->registry.record(index).button : nullptr;
 }
 
 QSize ButtonBox::sizeHint() const
@@ -695,10 +3879,24 @@ void ButtonBox::resizeEvent(QResizeEvent *e)
     d_ptr->updateGeo();
 }
 
+void ButtonBox::setVisible(bool visible)
+{
+    // Showing polishes the whole, possibly not yet polished, widget tree.
+    TraceScope trace(visible ? "ButtonBox::polishAndShow" : "ButtonBox::hide");
+    QScrollArea::setVisible(visible);
+}
+
 void ButtonBox::showEvent(QShowEvent *e)
 {
     QScrollArea::showEvent(e);
     d_ptr->updateGeo();
+
+    // A state restored before the first show scrolls once there is a range.
+    if (d_ptr->restoredScrollPosition.x() >= 0) {
+        horizontalScrollBar()->setValue(d_ptr->restoredScrollPosition.x());
+        verticalScrollBar()->setValue(d_ptr->restoredScrollPosition.y());
+        d_ptr->restoredScrollPosition = QPoint(-1, -1);
+    }
 }
 
 void ButtonBox::contextMenuEvent(QContextMenuEvent* e)
@@ -2,28 +2,248 @@
 #define BUTTONBOX_H
 
 #include <QScrollArea>
+#include <QIcon>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+
+#include <functional>
+
+// Lightweight description of a button; the box creates the widget itself,
+// in VirtualView only while the button is scrolled into view, and in
+// PaintedView not at all.
+struct ButtonBoxItem
+{
+    QString id;
+    QString text;
+    QString toolTip;
+    QIcon icon;
+    QString iconSource; // used when icon is null, decoded in the background
+    bool checkable = false;
+    bool checked = false;
+};
+
+// Work done for one category of the widget view since the last
+// ButtonBox::resetStatistics(). Times are cumulative, in nanoseconds.
+struct ButtonBoxStatistics
+{
+    int layoutPasses = 0;       // FlowLayout passes, cached or not
+    qint64 layoutNsecs = 0;
+    qint64 itemsPositioned = 0; // buttons moved by those passes
+    int geometryUpdates = 0;
+    qint64 geometryUpdateNsecs = 0;
+    int expandOperations = 0;   // expands and collapses
+    int popupBuilds = 0;        // sub-button popups filled or menus populated
+    qint64 popupBuildNsecs = 0;
+};
 
 class QToolButton;
+class QAbstractItemModel;
+class PaletteLoader;
+class QModelIndex;
 class ButtonBoxPrivate;
 class ButtonBox : public QScrollArea
 {
     Q_OBJECT
 public:
+    enum ViewMode {
+        WidgetView,  // one QToolButton per button, added via addButton()/addItem()
+        VirtualView, // only the items intersecting the viewport are materialized
+        PaintedView  // like VirtualView, but the items are painted, no widgets at all
+    };
+
+    // Model role holding the id reported by itemTriggered().
+    enum { IdRole = Qt::UserRole + 1 };
+
+    // Creates the sub-buttons of a root button the first time its menu is
+    // about to show. The box takes ownership of the returned buttons.
+    typedef std::function<QList<QToolButton*>(QToolButton* button)> SubButtonProvider;
+
     explicit ButtonBox(QWidget* parent = nullptr);
     ~ButtonBox();
 
+    // Items added with addItem()/addSubItem() go to the current view, set the
+    // mode before populating the box.
+    void setViewMode(ViewMode mode);
+    ViewMode viewMode() const;
+
+    void setItemIconSize(const QSize& size);
+    QSize itemIconSize() const;
+
+    // Persists the prescaled icons of every box in one file, and maps such
+    // a file so that later icon requests are served from it instead of
+    // decoding their source. Statistics are in IconCache::atlas().
+    static bool saveIconAtlas(const QString& fileName);
+    static bool loadIconAtlas(const QString& fileName);
+
+    // Gives the button a placeholder icon and replaces it with source once
+    // that is decoded, at the button's icon size, off the GUI thread.
+    // Identical sources are decoded once. Sources are file paths or
+    // resource paths.
+    void setButtonIconSource(QToolButton* button, const QString& source);
+
+    // Binds the widget view to a tree model: top-level rows are categories
+    // (keyed by their display text), their children root buttons and the
+    // grandchildren sub-buttons. Model changes are applied row by row. A
+    // string decoration is an icon source, see setButtonIconSource().
+    void setModel(QAbstractItemModel* model);
+    QAbstractItemModel* model() const;
+
+    // Adds the categories and buttons of an XML palette definition while
+    // the file is parsed, a slice per event loop pass. Returns the loader
+    // to follow the progress, or nullptr when the file cannot be opened.
+    // See PaletteLoader for the format.
+    PaletteLoader* loadPalette(const QString& fileName);
+
+    // Every button added to the box has a stable id: its object name when
+    // that is set and unique, a generated one otherwise.
+    QString buttonId(QToolButton* button) const;
+    QToolButton* button(const QString& id) const;
+
+    QString filterText() const;
+    // Buttons are indexed when added; call this after changing the text,
+    // tool tip or object name of one already in the box. A changed object
+    // name becomes its id when unique.
+    void updateFilterIndex(QToolButton* button);
+
+    QString searchText() const;
+    // Maximum number of buttons shown by the search, 0 shows every match.
+    void setSearchResultLimit(int limit);
+    int searchResultLimit() const;
+
+    void setSubButtonProvider(QToolButton* button, const SubButtonProvider& provider);
+
+    // Number of provider populated menus kept alive; the least recently
+    // shown ones beyond it drop their sub-buttons. 0 keeps all of them.
+    void setPopulatedMenuLimit(int limit);
+    int populatedMenuLimit() const;
+
+    // Per category counters, keyed by title. Diagnostics are logged to the
+    // "buttonbox" logging category, which is disabled by default, and a
+    // timeline of the same phases is kept by TraceRecorder when enabled.
+    QHash<QString, ButtonBoxStatistics> statistics() const;
+    void resetStatistics();
+
+    // Categories, their buttons and sub-buttons with id, text, tool tip,
+    // icon source and check state, the expanded categories and the scroll
+    // position of the widget view, in a compact versioned binary form.
+    // Widget view only: the other views save an empty state and restore
+    // nothing, returning false.
+    // Restoring replaces the content of the box; the buttons of collapsed
+    // categories are only created when the category first expands, when
+    // button() asks for one of them, when a filter or search needs them,
+    // or when they are checked and the box is exclusive. Buttons are restored as items,
+    // their providers, menus and connections are not part of the state.
+    QByteArray saveState() const;
+    bool restoreState(const QByteArray& state);
+    bool saveState(const QString& fileName) const;
+    // Maps the file instead of reading it.
+    bool restoreState(const QString& fileName);
+
+    // Defers all category and box relayouts until the matching endUpdate(),
+    // which then does a single geometry pass. Calls may be nested.
+    void beginUpdate();
+    void endUpdate();
+
+    // Length of the expand and collapse animation of a category header
+    // click, 0 disables it. Animations paint a snapshot of the category
+    // and lay it out for real once they end. expandAll(), collapseAll()
+    // and the filter never animate.
+    void setAnimationDuration(int msecs);
+    int animationDuration() const;
+
+    // Time the widget view spends creating queued buttons per event loop
+    // pass, in milliseconds. See addItemsAsync().
+    void setPopulationBudget(int msecs);
+    int populationBudget() const;
+    bool isPopulating() const;
+
+    void setVisible(bool visible) Q_DECL_OVERRIDE;
+
 public slots:
     void addButton(const QString& category, QToolButton* button);
+    void addButtons(const QString& category, const QList<QToolButton*>& buttons);
+    void insertButton(const QString& category, int index, QToolButton* button);
     void addSubButton(QToolButton* button, QToolButton* subButton);
+    void insertSubButton(QToolButton* button, int index, QToolButton* subButton);
+
+    QStringList categories() const;
+    void insertCategory(int index, const QString& category);
+
+    // Expansion changes apply at once but the box lays them out once, in
+    // the next event loop pass, however many categories changed.
+    void setExpanded(const QString& category, bool expanded);
+    bool isExpanded(const QString& category) const;
+    // Expands these categories and collapses all others, laid out before
+    // returning, as are expandAll() and collapseAll().
+    void setExpandedCategories(const QSet<QString>& categories);
+    QSet<QString> expandedCategories() const;
+
+    // Category offsets are kept in a prefix sum index, these take O(log n)
+    // in the number of categories. Widget view only. Scrolling to a button
+    // expands its category, a sub-button scrolls to its root button.
+    void scrollToCategory(const QString& category);
+    void scrollToButton(QToolButton* button);
+    // Title of the category at pos in viewport coordinates, y when vertical
+    // and x when horizontal, or an empty string.
+    QString categoryAt(int pos) const;
+    void renameCategory(const QString& category, const QString& title);
+
+    // Removed buttons are deleted, together with their sub-buttons.
+    void removeCategory(const QString& category);
+    void removeButton(QToolButton* button);
+    void clear();
+
+    void addItem(const QString& category, const ButtonBoxItem& item);
+    void addSubItem(const QString& parentId, const ButtonBoxItem& item);
+
+    // Queues the items of a category and returns at once. The widget view
+    // creates their buttons in chunks fitting the population budget, those
+    // of the categories nearest to the viewport first. Sub-items of queued
+    // items wait for their parent. The other views add them right away.
+    void addItemsAsync(const QString& category, const QList<ButtonBoxItem>& items);
 
     void expandAll();
     void collapseAll();
 
+    // Shows only the root buttons of the widget view having, for each word
+    // of text, a word in their text, tool tip or object name starting with
+    // it. Categories without matches collapse until they match again. An
+    // empty text shows everything.
+    void setFilterText(const QString& text);
+
+    // Typo tolerant search over the text, tool tip and object name of every
+    // root and sub-button of the widget view, ranked and run on a worker
+    // thread. The best matches show on top in a "Search results" category
+    // whose buttons click the ones they stand for. Sub-buttons made by a
+    // provider are not searched. An empty text hides the category, which
+    // is kept, with its buttons, for the next search.
+    void setSearchText(const QString& text);
+
+    // Horizontal places the categories side by side, each filling columns
+    // of buttons under its header, and scrolls horizontally. Switching
+    // relayouts the existing buttons.
     void setOrientation(Qt::Orientation o);
     Qt::Orientation orientation() const;
 
+    // Radio style checking over all root and sub-buttons of the widget
+    // view: checking one unchecks the previous one, the checked one cannot
+    // be unchecked. Turning it on keeps one checked button: the earliest
+    // added of those still in the box, though a button added after others
+    // were removed may reuse an earlier place and win over older ones.
     void setExclusive(bool exclusive);
     bool isExclusive() const;
+    // The checked button in exclusive mode, overall or in a category.
+    QToolButton* checkedButton() const;
+    QToolButton* checkedButton(const QString& category) const;
+
+signals:
+    void itemTriggered(const QString& id);
+    void indexTriggered(const QModelIndex& index);
+    void searchFinished(int hits);
+    void checkedButtonChanged(QToolButton* button);
+    void populationProgress(int done, int total);
+    void populationFinished();
 
 protected:
     QSize sizeHint() const;
@@ -1,13 +1,33 @@
+QT += concurrent
+
 INCLUDEPATH += $$PWD
 DEPENDPATH  += $$PWD
 
 HEADERS += $$PWD/clicklabel.h \
            $$PWD/buttonbox.h \
-           $$PWD/flowlayout.h
+           $$PWD/flowlayout.h \
+           $$PWD/iconcache.h \
+           $$PWD/iconatlas.h \
+           $$PWD/iconloader.h \
+           $$PWD/modeladapter.h \
+           $$PWD/tracerecorder.h \
+           $$PWD/prefixindex.h \
+           $$PWD/offsetindex.h \
+           $$PWD/fuzzysearch.h \
+           $$PWD/paletteloader.h
 
 SOURCES += $$PWD/clicklabel.cpp \
            $$PWD/buttonbox.cpp \
-           $$PWD/flowlayout.cpp
+           $$PWD/flowlayout.cpp \
+           $$PWD/iconcache.cpp \
+           $$PWD/iconatlas.cpp \
+           $$PWD/iconloader.cpp \
+           $$PWD/modeladapter.cpp \
+           $$PWD/tracerecorder.cpp \
+           $$PWD/prefixindex.cpp \
+           $$PWD/offsetindex.cpp \
+           $$PWD/fuzzysearch.cpp \
+           $$PWD/paletteloader.cpp
 
 RESOURCES += \
     $$PWD/images.qrc
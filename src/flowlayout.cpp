@@ -51,6 +51,8 @@
 #include <QtWidgets>
 
 #include "flowlayout.h"
+#include "tracerecorder.h"
+
 FlowLayout::FlowLayout(QWidget *parent, int margin, int hSpacing, int vSpacing)
     : QLayout(parent), m_hSpace(hSpacing), m_vSpace(vSpacing)
 {
@@ -77,9 +79,29 @@ void FlowLayout::clear()
 
 void FlowLayout::addItem(QLayoutItem *item)
 {
+    // Keep the cached geometries and hints, updateItemCache() only reads
+    // the hints of the new tail and cachedGeometry() continues from the
+    // last cursor.
     itemList.append(item);
 }
 
+void FlowLayout::insertItem(int index, QLayoutItem *item)
+{
+    if (index < 0 || index >= itemList.size()) {
+        addItem(item);
+    } else {
+        itemList.insert(index, item);
+        dropCache();
+    }
+    invalidate();
+}
+
+void FlowLayout::insertWidget(int index, QWidget *widget)
+{
+    addChildWidget(widget);
+    insertItem(index, new QWidgetItem(widget));
+}
+
 int FlowLayout::horizontalSpacing() const
 {
     if (m_hSpace >= 0) {
@@ -110,10 +132,20 @@ QLayoutItem *FlowLayout::itemAt(int index) const
 
 QLayoutItem *FlowLayout::takeAt(int index)
 {
-    if (index >= 0 && index < itemList.size())
+    if (index >= 0 && index < itemList.size()) {
+        dropCache();
         return itemList.takeAt(index);
-    else
+    } else {
         return 0;
+    }
+}
+
+void FlowLayout::invalidate()
+{
+    // Called when an item changes its size hint, the style changes or
+    // the margins are set; updateItemCache() works out which of them it was.
+    m_hintsDirty = true;
+    QLayout::invalidate();
 }
 
 Qt::Orientations FlowLayout::expandingDirections() const
@@ -123,15 +155,41 @@ Qt::Orientations FlowLayout::expandingDirections() const
 
 bool FlowLayout::hasHeightForWidth() const
 {
-    return true;
+    return m_flow == LeftToRight;
 }
 
 int FlowLayout::heightForWidth(int width) const
 {
+    if (m_flow != LeftToRight)
+        return -1;
+
     int height = doLayout(QRect(0, 0, width, 0), true);
     return height;
 }
 
+int FlowLayout::widthForHeight(int height) const
+{
+    if (m_flow != TopToBottom)
+        return -1;
+
+    return doLayout(QRect(0, 0, 0, height), true);
+}
+
+void FlowLayout::setFlow(Flow flow)
+{
+    if (m_flow == flow)
+        return;
+
+    m_flow = flow;
+    dropCache();
+    invalidate();
+}
+
+FlowLayout::Flow FlowLayout::flow() const
+{
+    return m_flow;
+}
+
 void FlowLayout::setGeometry(const QRect &rect)
 {
     QLayout::setGeometry(rect);
@@ -154,43 +212,184 @@ QSize FlowLayout::minimumSize() const
     return size;
 }
 
+FlowLayout::Statistics FlowLayout::statistics() const
+{
+    return m_statistics;
+}
+
+void FlowLayout::resetStatistics()
+{
+    m_statistics = Statistics();
+}
+
 int FlowLayout::doLayout(const QRect &rect, bool testOnly) const
 {
-    int left, top, right, bottom;
-    getContentsMargins(&left, &top, &right, &bottom);
-    QRect effectiveRect = rect.adjusted(+left, +top, -right, -bottom);
-    int x = effectiveRect.x();
-    int y = effectiveRect.y();
-    int lineHeight = 0;
+    TraceScope trace(!testOnly ? "FlowLayout::setGeometry"
+                               : m_flow == LeftToRight ? "FlowLayout::heightForWidth" : "FlowLayout::widthForHeight");
+    QElapsedTimer timer;
+    timer.start();
 
-    QLayoutItem *item;
-    foreach (item, itemList) {
-        QWidget *wid = item->widget();
-        int spaceX = horizontalSpacing();
-        if (spaceX == -1)
-            spaceX = wid->style()->layoutSpacing(
-                QSizePolicy::PushButton, QSizePolicy::PushButton, Qt::Horizontal);
-        int spaceY = verticalSpacing();
-        if (spaceY == -1)
-            spaceY = wid->style()->layoutSpacing(
-                QSizePolicy::PushButton, QSizePolicy::PushButton, Qt::Vertical);
-        int nextX = x + item->sizeHint().width() + spaceX;
+    const CachedGeometry &geometry = cachedGeometry(m_flow == LeftToRight ? rect.width() : rect.height());
+    const int length = geometry.length;
+
+    if (!testOnly) {
+        // Items already placed in this rect keep their geometry, only the
+        // ones appended since the last pass are positioned.
+        int first = 0;
+        if (rect == m_appliedRect)
+            first = qMin(m_appliedCount, geometry.rects.size());
+
+        // Take a copy, moving the items may re-enter heightForWidth().
+        const QVector<QRect> rects = geometry.rects;
+        const QPoint offset = rect.topLeft();
+        for (int i = first; i < rects.size(); ++i) {
+            if (!rects.at(i).isNull())
+                itemList.at(i)->setGeometry(rects.at(i).translated(offset));
+        }
+
+        m_appliedRect = rect;
+        m_appliedCount = rects.size();
+        m_statistics.itemsPositioned += rects.size() - first;
+    }
+
+    ++m_statistics.layoutPasses;
+    m_statistics.layoutNsecs += timer.nsecsElapsed();
+    return length;
+}
+
+const FlowLayout::CachedGeometry &FlowLayout::cachedGeometry(int extent) const
+{
+    updateItemCache();
+
+    for (int i = 0; i < m_geometryCache.size(); ++i) {
+        if (m_geometryCache.at(i).extent == extent) {
+            if (i > 0)
+                m_geometryCache.move(i, 0);
+            CachedGeometry &geometry = m_geometryCache.first();
+            layoutTail(geometry);
+            return geometry;
+        }
+    }
+
+    const QMargins margins = flowMargins();
+    CachedGeometry geometry;
+    geometry.extent = extent;
+    geometry.x = margins.left();
+    geometry.y = margins.top();
+    geometry.lineHeight = 0;
+    layoutTail(geometry);
+
+    m_geometryCache.prepend(geometry);
+    while (m_geometryCache.size() > MaxCachedWidths)
+        m_geometryCache.removeLast();
+
+    return m_geometryCache.first();
+}
+
+void FlowLayout::layoutTail(CachedGeometry &geometry) const
+{
+    const int first = geometry.rects.size();
+    if (first == m_sizeHints.size() && first > 0)
+        return;
+
+    // Columns are rows of the transposed items.
+    const bool columns = m_flow == TopToBottom;
+    const QMargins margins = flowMargins();
+    const int spaceX = columns ? m_spaceY : m_spaceX;
+    const int spaceY = columns ? m_spaceX : m_spaceY;
+
+    QRect effectiveRect = QRect(0, 0, geometry.extent, 0).marginsRemoved(margins);
+    int x = geometry.x;
+    int y = geometry.y;
+    int lineHeight = geometry.lineHeight;
+
+    geometry.rects.reserve(m_sizeHints.size());
+    for (int i = first; i < m_sizeHints.size(); ++i) {
+        if (!m_sizeHints.at(i).isValid()) {
+            // Hidden item, takes neither space nor spacing.
+            geometry.rects.append(QRect());
+            continue;
+        }
+        const QSize hint = columns ? m_sizeHints.at(i).transposed() : m_sizeHints.at(i);
+
+        int nextX = x + hint.width() + spaceX;
         if (nextX - spaceX > effectiveRect.right() && lineHeight > 0) {
             x = effectiveRect.x();
             y = y + lineHeight + spaceY;
-            nextX = x + item->sizeHint().width() + spaceX;
+            nextX = x + hint.width() + spaceX;
             lineHeight = 0;
         }
 
-        if (!testOnly)
-            item->setGeometry(QRect(QPoint(x, y), item->sizeHint()));
+        geometry.rects.append(columns ? QRect(QPoint(y, x), hint.transposed()) : QRect(QPoint(x, y), hint));
 
         x = nextX;
-        lineHeight = qMax(lineHeight, item->sizeHint().height());
+        lineHeight = qMax(lineHeight, hint.height());
     }
 
-    return y + lineHeight - rect.y() + bottom;
+    geometry.x = x;
+    geometry.y = y;
+    geometry.lineHeight = lineHeight;
+    geometry.length = y + lineHeight + margins.bottom();
 }
+
+QMargins FlowLayout::flowMargins() const
+{
+    if (m_flow == LeftToRight)
+        return m_margins;
+    return QMargins(m_margins.top(), m_margins.left(), m_margins.bottom(), m_margins.right());
+}
+
+void FlowLayout::updateItemCache() const
+{
+    if (!m_hintsDirty) {
+        // Only items appended since the last read are new.
+        for (int i = m_sizeHints.size(); i < itemList.size(); ++i) {
+            QLayoutItem *item = itemList.at(i);
+            m_sizeHints.append(item->isEmpty() ? QSize() : item->sizeHint());
+        }
+        return;
+    }
+    m_hintsDirty = false;
+
+    int spaceX = horizontalSpacing();
+    int spaceY = verticalSpacing();
+    if (spaceX == -1 || spaceY == -1) {
+        QWidget *wid = itemList.isEmpty() ? 0 : itemList.first()->widget();
+        QStyle *style = wid ? wid->style() : QApplication::style();
+        if (spaceX == -1)
+            spaceX = style->layoutSpacing(
+                QSizePolicy::PushButton, QSizePolicy::PushButton, Qt::Horizontal);
+        if (spaceY == -1)
+            spaceY = style->layoutSpacing(
+                QSizePolicy::PushButton, QSizePolicy::PushButton, Qt::Vertical);
+    }
+
+    QVector<QSize> hints;
+    hints.reserve(itemList.size());
+    foreach (QLayoutItem *item, itemList)
+        hints.append(item->isEmpty() ? QSize() : item->sizeHint());
+
+    const QMargins margins = contentsMargins();
+    if (margins != m_margins || spaceX != m_spaceX || spaceY != m_spaceY
+            || hints.size() < m_sizeHints.size()
+            || hints.mid(0, m_sizeHints.size()) != m_sizeHints) {
+        // Something other than the tail changed, reflow from scratch.
+        m_margins = margins;
+        m_spaceX = spaceX;
+        m_spaceY = spaceY;
+        m_geometryCache.clear();
+        m_appliedCount = 0;
+    }
+    m_sizeHints = hints;
+}
+
+void FlowLayout::dropCache()
+{
+    m_hintsDirty = true;
+    m_geometryCache.clear();
+    m_appliedCount = 0;
+}
+
 int FlowLayout::smartSpacing(QStyle::PixelMetric pm) const
 {
     QObject *parent = this->parent();
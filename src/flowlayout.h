@@ -54,35 +54,96 @@
 #include <QLayout>
 #include <QRect>
 #include <QStyle>
+#include <QVector>
 
 class FlowLayout : public QLayout
 {
 public:
+    // Work done by doLayout() since construction or resetStatistics().
+    struct Statistics
+    {
+        int layoutPasses = 0;
+        qint64 layoutNsecs = 0;
+        qint64 itemsPositioned = 0;
+    };
+
+    // LeftToRight fills rows and is sized by heightForWidth(), TopToBottom
+    // fills columns and is sized by widthForHeight().
+    enum Flow { LeftToRight, TopToBottom };
+
     explicit FlowLayout(QWidget *parent, int margin = -1, int hSpacing = -1, int vSpacing = -1);
     explicit FlowLayout(int margin = -1, int hSpacing = -1, int vSpacing = -1);
     ~FlowLayout();
 
     void clear();
     void addItem(QLayoutItem *item) Q_DECL_OVERRIDE;
+    void insertItem(int index, QLayoutItem *item);
+    void insertWidget(int index, QWidget *widget);
     int horizontalSpacing() const;
     int verticalSpacing() const;
     Qt::Orientations expandingDirections() const Q_DECL_OVERRIDE;
     bool hasHeightForWidth() const Q_DECL_OVERRIDE;
     int heightForWidth(int) const Q_DECL_OVERRIDE;
+    int widthForHeight(int) const;
+    void setFlow(Flow flow);
+    Flow flow() const;
     int count() const Q_DECL_OVERRIDE;
     QLayoutItem *itemAt(int index) const Q_DECL_OVERRIDE;
     QSize minimumSize() const Q_DECL_OVERRIDE;
     void setGeometry(const QRect &rect) Q_DECL_OVERRIDE;
     QSize sizeHint() const Q_DECL_OVERRIDE;
     QLayoutItem *takeAt(int index) Q_DECL_OVERRIDE;
+    void invalidate() Q_DECL_OVERRIDE;
+
+    Statistics statistics() const;
+    void resetStatistics();
 
 private:
+    // Item geometries for one extent, the width of rows or the height of
+    // columns, relative to the layout origin. Computed in flow coordinates,
+    // where a line always runs along x, and stored transposed back. The
+    // cursor (x, y, lineHeight) points past the last item so that appended
+    // items continue from the tail instead of reflowing the whole list.
+    struct CachedGeometry
+    {
+        int extent;
+        int length;     // height of the rows, width of the columns
+        int x;
+        int y;
+        int lineHeight;
+        QVector<QRect> rects;
+    };
+    enum { MaxCachedWidths = 4 };
+
     int doLayout(const QRect &rect, bool testOnly) const;
+    const CachedGeometry &cachedGeometry(int extent) const;
+    QMargins flowMargins() const;
+    void layoutTail(CachedGeometry &geometry) const;
+    void updateItemCache() const;
+    void dropCache();
     int smartSpacing(QStyle::PixelMetric pm) const;
 
     QList<QLayoutItem *> itemList;
     int m_hSpace;
     int m_vSpace;
+    Flow m_flow = LeftToRight;
+
+    // Size hints, spacing and margins the cached geometries were computed
+    // with; re-read lazily after invalidate() and compared, so the geometry
+    // cache only goes away when one of them really changed. Appending only
+    // reads the hints of the new items.
+    mutable QVector<QSize> m_sizeHints;
+    mutable QMargins m_margins;
+    mutable int m_spaceX = -1;
+    mutable int m_spaceY = -1;
+    mutable bool m_hintsDirty = true;
+    mutable QList<CachedGeometry> m_geometryCache;
+
+    // Rect of the last setGeometry() and how many items were placed in it.
+    mutable QRect m_appliedRect;
+    mutable int m_appliedCount = 0;
+
+    mutable Statistics m_statistics;
 };
 
 #endif // FLOWLAYOUT_H
@@ -0,0 +1,226 @@
+#include "fuzzysearch.h"
+
+#include <QtConcurrent>
+#include <QSet>
+
+#include <algorithm>
+
+// Entries scanned between two looks at the cancellation flag.
+static const int CancelCheckInterval = 1024;
+
+static QSet<QString> trigrams(const QString& text)
+{
+    QSet<QString> result;
+    for (int i = 0; i + 3 <= text.size(); ++i)
+        result.insert(text.mid(i, 3));
+    return result;
+}
+
+TrigramIndex::TrigramIndex(const QVector<SearchEntry>& entries)
+{
+    m_texts.reserve(entries.size());
+    m_ids.reserve(entries.size());
+
+    foreach (const SearchEntry& entry, entries) {
+        const QString text = normalized(entry.text);
+        if (text.isEmpty())
+            continue;
+
+        const int position = m_texts.size();
+        m_texts.append(text);
+        m_ids.append(entry.id);
+        foreach (const QString& trigram, trigrams(text))
+            m_postings[trigram].append(position);
+    }
+}
+
+QVector<SearchHit> TrigramIndex::query(const QString& text, int limit, const std::function<bool()>& cancelled) const
+{
+    struct Candidate
+    {
+        int position;
+        qreal score;
+    };
+
+    QVector<SearchHit> hits;
+    const QString q = normalized(text);
+    if (q.isEmpty())
+        return hits;
+
+    const QSet<QString> queryTrigrams = trigrams(q);
+    QVector<Candidate> candidates;
+
+    if (queryTrigrams.isEmpty()) {
+        // Too short for trigrams, every entry is a candidate.
+        for (int i = 0; i < m_texts.size(); ++i) {
+            if (i % CancelCheckInterval == 0 && cancelled())
+                return hits;
+
+            const qreal s = score(q, m_texts.at(i), 0, 0);
+            if (s > 0) {
+                Candidate c = { i, s };
+                candidates.append(c);
+            }
+        }
+    } else {
+        QVector<int> shared(m_texts.size(), 0);
+        QVector<int> touched;
+        foreach (const QString& trigram, queryTrigrams) {
+            if (cancelled())
+                return hits;
+
+            auto iter = m_postings.constFind(trigram);
+            if (iter == m_postings.constEnd())
+                continue;
+            foreach (int position, iter.value()) {
+                if (shared[position]++ == 0)
+                    touched.append(position);
+            }
+        }
+
+        for (int i = 0; i < touched.size(); ++i) {
+            if (i % CancelCheckInterval == 0 && cancelled())
+                return hits;
+
+            const int position = touched.at(i);
+            const qreal s = score(q, m_texts.at(position), shared.at(position), queryTrigrams.size());
+            if (s > 0) {
+                Candidate c = { position, s };
+                candidates.append(c);
+            }
+        }
+    }
+
+    if (cancelled())
+        return hits;
+
+    // Higher score first, then the shorter, more specific text.
+    auto better = [this](const Candidate& a, const Candidate& b) {
+        if (a.score != b.score)
+            return a.score > b.score;
+        if (m_texts.at(a.position).size() != m_texts.at(b.position).size())
+            return m_texts.at(a.position).size() < m_texts.at(b.position).size();
+        return a.position < b.position;
+    };
+
+    const int count = limit > 0 ? qMin(limit, candidates.size()) : candidates.size();
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(), better);
+
+    hits.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        SearchHit hit = { m_ids.at(candidates.at(i).position), candidates.at(i).score };
+        hits.append(hit);
+    }
+    return hits;
+}
+
+QString TrigramIndex::normalized(const QString& text)
+{
+    QString result;
+    result.reserve(text.size());
+    foreach (const QChar& c, text) {
+        if (c.isLetterOrNumber())
+            result.append(c.toCaseFolded());
+    }
+    return result;
+}
+
+qreal TrigramIndex::score(const QString& query, const QString& text, int sharedTrigrams, int queryTrigrams)
+{
+    // How tightly the query letters appear, in order, in the text: 1 for
+    // a substring, less the more they are spread out, 0 when they do not.
+    qreal ordered = 0;
+    if (text.contains(query)) {
+        ordered = 1;
+    } else {
+        int first = -1;
+        int next = 0;
+        for (int i = 0; i < text.size() && next < query.size(); ++i) {
+            if (text.at(i) == query.at(next)) {
+                if (first == -1)
+                    first = i;
+                ++next;
+                if (next == query.size())
+                    ordered = qreal(query.size()) / (i - first + 1);
+            }
+        }
+    }
+
+    if (queryTrigrams == 0)
+        return ordered;
+
+    // Typos break the subsequence, then half the trigrams must still match.
+    const qreal similarity = qreal(sharedTrigrams) / queryTrigrams;
+    if (ordered == 0 && similarity < 0.5)
+        return 0;
+    return (ordered + similarity) / 2;
+}
+
+SearchSnapshot::SearchSnapshot(const QVector<SearchEntry>& entries) :
+    m_entries(entries)
+{
+}
+
+const TrigramIndex& SearchSnapshot::index() const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_index)
+        m_index.reset(new TrigramIndex(m_entries));
+    return *m_index;
+}
+
+FuzzySearch::FuzzySearch(QObject* parent) : QObject(parent),
+    m_generation(new QAtomicInt(0))
+{
+    connect(&m_watcher, SIGNAL(finished()), this, SLOT(onFinished()));
+}
+
+FuzzySearch::~FuzzySearch()
+{
+    // The worker only holds shared data, it is left to finish on its own.
+    cancel();
+}
+
+void FuzzySearch::setEntries(const QVector<SearchEntry>& entries)
+{
+    cancel();
+    m_snapshot.reset(new SearchSnapshot(entries));
+}
+
+void FuzzySearch::search(const QString& text, int limit)
+{
+    cancel();
+    if (!m_snapshot)
+        return;
+
+    const int generation = m_generation->fetchAndAddOrdered(1) + 1;
+    m_pending = generation;
+
+    const QSharedPointer<const SearchSnapshot> snapshot = m_snapshot;
+    const QSharedPointer<QAtomicInt> current = m_generation;
+    m_watcher.setFuture(QtConcurrent::run([snapshot, current, generation, text, limit]() {
+        auto cancelled = [current, generation]() { return current->loadAcquire() != generation; };
+        if (cancelled())
+            return QVector<SearchHit>();
+        return snapshot->index().query(text, limit, cancelled);
+    }));
+}
+
+void FuzzySearch::cancel()
+{
+    if (m_pending == -1)
+        return;
+
+    m_pending = -1;
+    m_generation->fetchAndAddOrdered(1);
+}
+
+void FuzzySearch::onFinished()
+{
+    // A finished signal may still arrive for a replaced or cancelled query.
+    if (m_pending == -1 || m_pending != m_generation->loadAcquire() || !m_watcher.isFinished())
+        return;
+
+    m_pending = -1;
+    emit finished(m_watcher.result());
+}
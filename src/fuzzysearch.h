@@ -0,0 +1,94 @@
+#ifndef FUZZYSEARCH_H
+#define FUZZYSEARCH_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QVector>
+#include <QFutureWatcher>
+
+#include <functional>
+
+// Searchable text of one button, id is the caller's key.
+struct SearchEntry
+{
+    int id;
+    QString text;
+};
+
+struct SearchHit
+{
+    int id;
+    qreal score; // in (0, 1], higher is better
+};
+
+// Trigram postings over normalized entry texts: case folded, letters and
+// digits only, so "gausblr" shares trigrams with "Gaussian Blur". Queries
+// shorter than a trigram are matched as subsequences of every entry.
+class TrigramIndex
+{
+public:
+    explicit TrigramIndex(const QVector<SearchEntry>& entries);
+
+    // Best matches first. Gives up early, returning nothing, once
+    // cancelled() turns true.
+    QVector<SearchHit> query(const QString& text, int limit, const std::function<bool()>& cancelled) const;
+
+    static QString normalized(const QString& text);
+
+private:
+    static qreal score(const QString& query, const QString& text, int sharedTrigrams, int queryTrigrams);
+
+    QVector<QString> m_texts;
+    QVector<int> m_ids;
+    QHash<QString, QVector<int> > m_postings; // entry positions, ascending
+};
+
+// Immutable copy of the button metadata. Its index is built on first use
+// by whichever worker needs it.
+class SearchSnapshot
+{
+public:
+    explicit SearchSnapshot(const QVector<SearchEntry>& entries);
+
+    const TrigramIndex& index() const;
+
+private:
+    QVector<SearchEntry> m_entries;
+    mutable QMutex m_mutex;
+    mutable QScopedPointer<TrigramIndex> m_index;
+};
+
+// Runs queries against the current snapshot on the global thread pool.
+// A new query or snapshot cancels the running one; only the result of the
+// latest query is reported, on the thread owning the object.
+class FuzzySearch : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FuzzySearch(QObject* parent = nullptr);
+    ~FuzzySearch();
+
+    void setEntries(const QVector<SearchEntry>& entries);
+    bool hasEntries() const { return !m_snapshot.isNull(); }
+
+    void search(const QString& text, int limit);
+    void cancel();
+    bool isRunning() const { return m_watcher.isRunning(); }
+
+signals:
+    void finished(const QVector<SearchHit>& hits);
+
+private slots:
+    void onFinished();
+
+private:
+    QSharedPointer<const SearchSnapshot> m_snapshot;
+    QSharedPointer<QAtomicInt> m_generation;
+    QFutureWatcher<QVector<SearchHit> > m_watcher;
+    int m_pending = -1; // generation of the query being waited for
+};
+
+#endif // FUZZYSEARCH_H
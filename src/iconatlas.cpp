@@ -0,0 +1,219 @@
+#include "iconatlas.h"
+#include "iconcache.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
+
+static const quint32 AtlasMagic = 0x42424941; // "BBIA"
+static const quint32 AtlasVersion = 1;
+static const qint64 HeaderSize = 16;          // magic, version, count, table size
+static const int DataAlignment = 16;
+// Empty key length, stamp, width, height, bytes per line and offset.
+static const quint32 MinEntrySize = 4 + 8 + 8 + 4 + 4 + 4 + 8;
+
+static qint64 aligned(qint64 offset)
+{
+    return (offset + DataAlignment - 1) / DataAlignment * DataAlignment;
+}
+
+IconAtlas::IconAtlas()
+{
+}
+
+IconAtlas::~IconAtlas()
+{
+    close();
+}
+
+bool IconAtlas::open(const QString& fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&m_file);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic, version, count, tableSize;
+    stream >> magic >> version >> count >> tableSize;
+    if (stream.status() != QDataStream::Ok || magic != AtlasMagic || version != AtlasVersion) {
+        m_file.close();
+        return false;
+    }
+
+    // Nothing read from the file is trusted: the table must fit the file
+    // and can hold no more entries than their smallest encoding allows.
+    const qint64 dataStart = aligned(HeaderSize + qint64(tableSize));
+    if (dataStart > m_file.size() || count > tableSize / MinEntrySize) {
+        m_file.close();
+        return false;
+    }
+
+    QHash<QString, Entry> entries;
+    entries.reserve(int(count));
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString key;
+        Entry entry;
+        stream >> key >> entry.stamp.modified >> entry.stamp.size
+               >> entry.width >> entry.height >> entry.bytesPerLine >> entry.offset;
+        entries.insert(key, entry);
+    }
+
+    if (stream.status() != QDataStream::Ok || m_file.pos() > HeaderSize + qint64(tableSize)) {
+        m_file.close();
+        return false;
+    }
+
+    // Entries with impossible geometry, or pointing past the end of a
+    // truncated file, are dropped.
+    const qint64 dataSize = m_file.size() - dataStart;
+    for (auto iter = entries.begin(); iter != entries.end();) {
+        const bool valid = iter->width > 0 && iter->height > 0
+                && qint64(iter->bytesPerLine) >= qint64(iter->width) * 4
+                && iter->offset >= 0 && iter->offset <= dataSize
+                && qint64(iter->bytesPerLine) * iter->height <= dataSize - iter->offset;
+        if (valid)
+            ++iter;
+        else
+            iter = entries.erase(iter);
+    }
+
+    m_data = m_file.map(0, m_file.size());
+    if (!m_data) {
+        m_file.close();
+        return false;
+    }
+
+    m_dataStart = dataStart;
+    m_entries.swap(entries);
+    return true;
+}
+
+void IconAtlas::close()
+{
+    if (m_data)
+        m_file.unmap(m_data);
+    m_data = nullptr;
+    m_file.close();
+    m_entries.clear();
+    m_stamps.clear();
+}
+
+QImage IconAtlas::image(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio)
+{
+    auto iter = m_entries.constFind(IconCache::key(source, size, mode, devicePixelRatio));
+    if (iter == m_entries.constEnd()) {
+        ++m_misses;
+        return QImage();
+    }
+
+    if (iter->stamp != stamp(source)) {
+        ++m_stale;
+        ++m_misses;
+        m_entries.erase(iter);
+        return QImage();
+    }
+
+    ++m_hits;
+    return entryImage(*iter);
+}
+
+bool IconAtlas::write(const QString& fileName, const QList<Image>& images)
+{
+    struct Pending
+    {
+        QString key;
+        Entry entry;
+        QImage image;
+    };
+
+    QList<Pending> pending;
+    QHash<QString, int> positions;
+    qint64 offset = 0;
+
+    auto append = [&](const QString& key, const Stamp& s, const QImage& image) {
+        Pending p;
+        p.key = key;
+        p.image = image;
+        p.entry.stamp = s;
+        p.entry.width = image.width();
+        p.entry.height = image.height();
+        p.entry.bytesPerLine = image.bytesPerLine();
+        p.entry.offset = offset;
+        offset = aligned(offset + qint64(image.bytesPerLine()) * image.height());
+        positions.insert(key, pending.size());
+        pending.append(p);
+    };
+
+    foreach (const Image& image, images) {
+        const QString key = IconCache::key(image.source, image.size, image.mode, image.devicePixelRatio);
+        if (image.image.isNull() || positions.contains(key))
+            continue;
+        append(key, stamp(image.source), image.image.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+    }
+
+    for (auto iter = m_entries.constBegin(); iter != m_entries.constEnd(); ++iter) {
+        const QString source = iter.key().section('|', 0, -4);
+        if (!positions.contains(iter.key()) && iter->stamp == stamp(source))
+            append(iter.key(), iter->stamp, entryImage(*iter));
+    }
+
+    QByteArray table;
+    {
+        QDataStream stream(&table, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_6);
+        foreach (const Pending& p, pending) {
+            stream << p.key << p.entry.stamp.modified << p.entry.stamp.size
+                   << p.entry.width << p.entry.height << p.entry.bytesPerLine << p.entry.offset;
+        }
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << AtlasMagic << AtlasVersion << quint32(pending.size()) << quint32(table.size());
+    file.write(table);
+
+    const qint64 dataStart = aligned(HeaderSize + table.size());
+    foreach (const Pending& p, pending) {
+        const qint64 position = dataStart + p.entry.offset;
+        file.write(QByteArray(int(position - file.pos()), '\0'));
+        file.write(reinterpret_cast<const char*>(p.image.constBits()), qint64(p.entry.bytesPerLine) * p.entry.height);
+    }
+
+    return stream.status() == QDataStream::Ok && file.commit();
+}
+
+void IconAtlas::resetStatistics()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_stale = 0;
+}
+
+IconAtlas::Stamp IconAtlas::stamp(const QString& source)
+{
+    auto iter = m_stamps.constFind(source);
+    if (iter != m_stamps.constEnd())
+        return iter.value();
+
+    // Resources have no modification time, they change with the binary.
+    const QFileInfo info(source);
+    const QDateTime modified = info.lastModified();
+    Stamp s = { modified.isValid() ? modified.toMSecsSinceEpoch() : 0, info.size() };
+    m_stamps.insert(source, s);
+    return s;
+}
+
+QImage IconAtlas::entryImage(const Entry& entry) const
+{
+    return QImage(m_data + m_dataStart + entry.offset, entry.width, entry.height, entry.bytesPerLine,
+                  QImage::Format_ARGB32_Premultiplied);
+}
@@ -0,0 +1,82 @@
+#ifndef ICONATLAS_H
+#define ICONATLAS_H
+
+#include <QFile>
+#include <QHash>
+#include <QIcon>
+#include <QImage>
+
+// Prescaled icon images in one file, mapped into memory when opened so a
+// lookup only wraps the mapped pixels, nothing is decoded. Entries are
+// keyed like IconCache and stamped with the modification time and size of
+// their source, an entry whose source changed since is stale and skipped.
+class IconAtlas
+{
+public:
+    struct Image
+    {
+        QString source;
+        QSize size;
+        QIcon::Mode mode;
+        qreal devicePixelRatio;
+        QImage image;
+    };
+
+    IconAtlas();
+    ~IconAtlas();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+    int count() const { return m_entries.size(); }
+
+    // The entry, sharing the mapped memory until the atlas is closed, or a
+    // null image when there is none or it is stale.
+    QImage image(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio);
+
+    // Writes images, and the entries of the open atlas that are neither
+    // stale nor replaced by one of them, to fileName. The open atlas stays
+    // mapped, the file is replaced atomically.
+    bool write(const QString& fileName, const QList<Image>& images);
+
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+    quint64 staleEntries() const { return m_stale; }
+    void resetStatistics();
+
+private:
+    Q_DISABLE_COPY(IconAtlas)
+
+    struct Stamp
+    {
+        qint64 modified;
+        qint64 size;
+
+        bool operator==(const Stamp& other) const { return modified == other.modified && size == other.size; }
+        bool operator!=(const Stamp& other) const { return !(*this == other); }
+    };
+
+    struct Entry
+    {
+        Stamp stamp;
+        qint32 width;
+        qint32 height;
+        qint32 bytesPerLine;
+        qint64 offset; // from the start of the data section
+    };
+
+    Stamp stamp(const QString& source);
+    QImage entryImage(const Entry& entry) const;
+
+    QFile m_file;
+    uchar* m_data = nullptr;
+    qint64 m_dataStart = 0;
+    QHash<QString, Entry> m_entries;
+    QHash<QString, Stamp> m_stamps; // sources stat()ed this session
+
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+    quint64 m_stale = 0;
+};
+
+#endif // ICONATLAS_H
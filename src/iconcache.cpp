@@ -0,0 +1,178 @@
+#include "iconcache.h"
+
+#include <QApplication>
+#include <QImageReader>
+#include <QStyle>
+#include <QStyleOption>
+
+IconCache::IconCache()
+{
+    setByteBudget(8 * 1024 * 1024);
+}
+
+static IconCache* s_instance = nullptr;
+
+IconCache* IconCache::instance()
+{
+    if (!s_instance) {
+        s_instance = new IconCache;
+        qAddPostRoutine(destroyInstance);
+    }
+    return s_instance;
+}
+
+void IconCache::destroyInstance()
+{
+    delete s_instance;
+    s_instance = nullptr;
+}
+
+QPixmap IconCache::pixmap(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio)
+{
+    const QString k = key(source, size, mode, devicePixelRatio);
+    if (Entry* cached = m_pixmaps.object(k)) {
+        ++m_hits;
+        return cached->pixmap;
+    }
+
+    ++m_misses;
+    const QPixmap restored = restore(source, size, mode, devicePixelRatio);
+    if (!restored.isNull())
+        return restored;
+
+    const QPixmap pm = load(source, size, mode, devicePixelRatio);
+    if (!pm.isNull())
+        insert(source, size, mode, devicePixelRatio, pm);
+    return pm;
+}
+
+QIcon IconCache::icon(const QString& source, const QSize& size, qreal devicePixelRatio)
+{
+    const QString k = key(source, size, QIcon::Normal, devicePixelRatio);
+    Entry* cached = m_pixmaps.object(k);
+    if (cached && !cached->icon.isNull()) {
+        ++m_hits;
+        return cached->icon;
+    }
+
+    // Other modes are generated by QIcon itself when first painted.
+    QIcon icon;
+    icon.addPixmap(pixmap(source, size, QIcon::Normal, devicePixelRatio), QIcon::Normal);
+    if (Entry* entry = m_pixmaps.object(k))
+        entry->icon = icon;
+    return icon;
+}
+
+void IconCache::insert(const QString& source, const QSize& size, QIcon::Mode mode,
+                       qreal devicePixelRatio, const QPixmap& pixmap)
+{
+    const int cost = pixmap.width() * pixmap.height() * qMax(1, pixmap.depth() / 8);
+    IconAtlas::Image image = { source, size, mode, devicePixelRatio, QImage() };
+    Entry* entry = new Entry;
+    entry->pixmap = pixmap;
+    entry->source = image;
+    m_pixmaps.insert(key(source, size, mode, devicePixelRatio), entry, cost);
+}
+
+QPixmap IconCache::restore(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio)
+{
+    if (!m_atlas.isOpen())
+        return QPixmap();
+
+    const QImage image = m_atlas.image(source, size, mode, devicePixelRatio);
+    if (image.isNull())
+        return QPixmap();
+
+    // One copy out of the mapping, so the pixmap outlives the atlas; the
+    // temporary is then converted in place.
+    QPixmap pm = QPixmap::fromImage(image.copy());
+    pm.setDevicePixelRatio(devicePixelRatio);
+    insert(source, size, mode, devicePixelRatio, pm);
+    return pm;
+}
+
+bool IconCache::openAtlas(const QString& fileName)
+{
+    return m_atlas.open(fileName);
+}
+
+bool IconCache::saveAtlas(const QString& fileName)
+{
+    QList<IconAtlas::Image> images;
+    foreach (const QString& k, m_pixmaps.keys()) {
+        const Entry* entry = m_pixmaps.object(k);
+        IconAtlas::Image image = entry->source;
+        image.image = entry->pixmap.toImage();
+        images.append(image);
+    }
+
+    return m_atlas.write(fileName, images);
+}
+
+bool IconCache::contains(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio) const
+{
+    return m_pixmaps.contains(key(source, size, mode, devicePixelRatio));
+}
+
+void IconCache::setByteBudget(int bytes)
+{
+    m_pixmaps.setMaxCost(bytes);
+}
+
+int IconCache::byteBudget() const
+{
+    return m_pixmaps.maxCost();
+}
+
+int IconCache::bytesUsed() const
+{
+    return m_pixmaps.totalCost();
+}
+
+void IconCache::resetStatistics()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_atlas.resetStatistics();
+}
+
+void IconCache::clear()
+{
+    m_pixmaps.clear();
+}
+
+QString IconCache::key(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio)
+{
+    return QString("%1|%2x%3|%4|%5").arg(source).arg(size.width()).arg(size.height())
+            .arg(int(mode)).arg(devicePixelRatio);
+}
+
+QImage IconCache::decode(const QString& source, const QSize& size, qreal devicePixelRatio)
+{
+    // Let the reader scale while decoding, SVG and JPEG do that for free.
+    QImageReader reader(source);
+    const QSize target = size * devicePixelRatio;
+    if (reader.size().isValid())
+        reader.setScaledSize(reader.size().scaled(target, Qt::KeepAspectRatio));
+
+    QImage image = reader.read();
+    if (!image.isNull() && (image.width() > target.width() || image.height() > target.height()))
+        image = image.scaled(target, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return image;
+}
+
+QPixmap IconCache::load(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio)
+{
+    const QImage image = decode(source, size, devicePixelRatio);
+    if (image.isNull())
+        return QPixmap();
+
+    QPixmap pm = QPixmap::fromImage(image);
+    if (mode != QIcon::Normal) {
+        QStyleOption option;
+        option.palette = QApplication::palette();
+        pm = QApplication::style()->generatedIconPixmap(mode, pm, &option);
+    }
+    pm.setDevicePixelRatio(devicePixelRatio);
+    return pm;
+}
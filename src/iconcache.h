@@ -0,0 +1,80 @@
+#ifndef ICONCACHE_H
+#define ICONCACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QIcon>
+#include <QPixmap>
+
+#include "iconatlas.h"
+
+// Prescaled pixmaps shared by every ButtonBox, keyed by source, size,
+// icon mode and device pixel ratio. GUI thread only. Destroyed with the
+// application, before the pixmaps would outlive it.
+class IconCache
+{
+public:
+    static IconCache* instance();
+
+    QPixmap pixmap(const QString& source, const QSize& size,
+                   QIcon::Mode mode = QIcon::Normal, qreal devicePixelRatio = 1.0);
+    QIcon icon(const QString& source, const QSize& size, qreal devicePixelRatio = 1.0);
+
+    void insert(const QString& source, const QSize& size, QIcon::Mode mode,
+                qreal devicePixelRatio, const QPixmap& pixmap);
+    bool contains(const QString& source, const QSize& size,
+                  QIcon::Mode mode = QIcon::Normal, qreal devicePixelRatio = 1.0) const;
+
+    // Upper bound for the decoded pixmap data held by the cache.
+    void setByteBudget(int bytes);
+    int byteBudget() const;
+    int bytesUsed() const;
+
+    // Loads the pixmap from the atlas into the cache and returns it, null
+    // when the atlas has no current entry for it. A pixmap costing more than
+    // the byte budget is returned without being cached.
+    QPixmap restore(const QString& source, const QSize& size,
+                 QIcon::Mode mode = QIcon::Normal, qreal devicePixelRatio = 1.0);
+
+    // Cache misses are looked up in the opened atlas before decoding. Saving
+    // writes every cached pixmap, together with the still current entries
+    // of the opened atlas.
+    bool openAtlas(const QString& fileName);
+    bool saveAtlas(const QString& fileName);
+    IconAtlas* atlas() { return &m_atlas; }
+
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+    void resetStatistics();
+
+    void clear();
+
+    static QString key(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio);
+
+    // Reads source scaled to fit size * devicePixelRatio. Thread safe, the
+    // image becomes a pixmap on the GUI thread.
+    static QImage decode(const QString& source, const QSize& size, qreal devicePixelRatio);
+
+private:
+    IconCache();
+    Q_DISABLE_COPY(IconCache)
+
+    static void destroyInstance();
+    static QPixmap load(const QString& source, const QSize& size, QIcon::Mode mode, qreal devicePixelRatio);
+
+    // The icon made from a pixmap is evicted with it, so the byte budget
+    // bounds both.
+    struct Entry
+    {
+        QPixmap pixmap;
+        QIcon icon;
+        IconAtlas::Image source; // what the key stands for, image left null
+    };
+
+    QCache<QString, Entry> m_pixmaps;
+    IconAtlas m_atlas;
+    quint64 m_hits = 0;
+    quint64 m_misses = 0;
+};
+
+#endif // ICONCACHE_H
@@ -0,0 +1,134 @@
+#include "iconloader.h"
+#include "iconcache.h"
+
+#include <QCoreApplication>
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QPainter>
+
+IconLoader::IconLoader()
+{
+    // Decoding is I/O and memory bound, leave cores to the application.
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}
+
+static IconLoader* s_instance = nullptr;
+
+IconLoader* IconLoader::instance()
+{
+    if (!s_instance) {
+        s_instance = new IconLoader;
+        qAddPostRoutine(destroyInstance);
+    }
+    return s_instance;
+}
+
+void IconLoader::destroyInstance()
+{
+    // Decodes still running finish before their watchers go.
+    s_instance->m_pool.waitForDone();
+    delete s_instance;
+    s_instance = nullptr;
+}
+
+QIcon IconLoader::icon(const QString& source, const QSize& size, qreal devicePixelRatio, bool* ready)
+{
+    IconCache* cache = IconCache::instance();
+    const QString key = IconCache::key(source, size, QIcon::Normal, devicePixelRatio);
+
+    if (m_failed.contains(key)) {
+        if (ready)
+            *ready = true;
+        return QIcon();
+    }
+    bool cached = cache->contains(source, size, QIcon::Normal, devicePixelRatio);
+    if (!cached) {
+        const QPixmap restored = cache->restore(source, size, QIcon::Normal, devicePixelRatio);
+        if (!restored.isNull() && !cache->contains(source, size, QIcon::Normal, devicePixelRatio)) {
+            // Over the byte budget, the cache did not keep it.
+            if (ready)
+                *ready = true;
+            return QIcon(restored);
+        }
+        cached = !restored.isNull();
+    }
+    if (cached) {
+        if (ready)
+            *ready = true;
+        return cache->icon(source, size, devicePixelRatio);
+    }
+
+    if (ready)
+        *ready = false;
+
+    if (!m_queued.contains(key)) {
+        m_queued.insert(key);
+
+        QFutureWatcher<QImage>* watcher = new QFutureWatcher<QImage>(this);
+        Request request = { source, size, devicePixelRatio };
+        m_pending.insert(watcher, request);
+        connect(watcher, SIGNAL(finished()), this, SLOT(onDecoded()));
+        watcher->setFuture(QtConcurrent::run(&m_pool, IconCache::decode, source, size, devicePixelRatio));
+    }
+
+    return placeholder(size, devicePixelRatio);
+}
+
+void IconLoader::waitForDone()
+{
+    m_pool.waitForDone();
+    foreach (QFutureWatcher<QImage>* watcher, m_pending.keys())
+        finish(watcher);
+}
+
+void IconLoader::onDecoded()
+{
+    QFutureWatcher<QImage>* watcher = static_cast<QFutureWatcher<QImage>*>(sender());
+    if (m_pending.contains(watcher))
+        finish(watcher);
+}
+
+void IconLoader::finish(QFutureWatcher<QImage>* watcher)
+{
+    const Request request = m_pending.take(watcher);
+    const QString key = IconCache::key(request.source, request.size, QIcon::Normal, request.devicePixelRatio);
+    m_queued.remove(key);
+
+    // QPixmap is GUI thread only, the conversion happens here.
+    const QImage image = watcher->future().result();
+    watcher->deleteLater();
+
+    if (image.isNull()) {
+        m_failed.insert(key);
+    } else {
+        QPixmap pm = QPixmap::fromImage(image);
+        pm.setDevicePixelRatio(request.devicePixelRatio);
+        IconCache::instance()->insert(request.source, request.size, QIcon::Normal, request.devicePixelRatio, pm);
+    }
+
+    emit iconLoaded(request.source);
+}
+
+QIcon IconLoader::placeholder(const QSize& size, qreal devicePixelRatio)
+{
+    const QString key = IconCache::key(QString(), size, QIcon::Normal, devicePixelRatio);
+    auto iter = m_placeholders.constFind(key);
+    if (iter != m_placeholders.constEnd())
+        return iter.value();
+
+    // A faint rounded frame, drawn once per size.
+    QPixmap pm(size * devicePixelRatio);
+    pm.setDevicePixelRatio(devicePixelRatio);
+    pm.fill(Qt::transparent);
+
+    QPainter painter(&pm);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QColor(0, 0, 0, 40));
+    painter.setBrush(QColor(0, 0, 0, 16));
+    painter.drawRoundedRect(QRectF(QPointF(0, 0), QSizeF(size)).adjusted(2.5, 2.5, -2.5, -2.5), 3, 3);
+    painter.end();
+
+    QIcon icon(pm);
+    m_placeholders.insert(key, icon);
+    return icon;
+}
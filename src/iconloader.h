@@ -0,0 +1,62 @@
+#ifndef ICONLOADER_H
+#define ICONLOADER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QIcon>
+#include <QThreadPool>
+
+template <typename T> class QFutureWatcher;
+
+// Decodes icon sources into IconCache on a thread pool. A request for a
+// source not cached yet returns a placeholder and queues one decode per
+// source, size and device pixel ratio, however often it is asked for.
+// GUI thread only, the decoding aside. Destroyed with the application.
+class IconLoader : public QObject
+{
+    Q_OBJECT
+public:
+    static IconLoader* instance();
+
+    // The cached icon, or a placeholder until the source is decoded. ready
+    // tells which; a source that failed to decode gives a null icon.
+    QIcon icon(const QString& source, const QSize& size, qreal devicePixelRatio = 1.0, bool* ready = nullptr);
+
+    int pendingCount() const { return m_pending.size(); }
+    // Blocks until every queued decode is in the cache.
+    void waitForDone();
+
+    QThreadPool* threadPool() { return &m_pool; }
+
+signals:
+    // Requests for source now return the decoded icon.
+    void iconLoaded(const QString& source);
+
+private slots:
+    void onDecoded();
+
+private:
+    IconLoader();
+    Q_DISABLE_COPY(IconLoader)
+
+    static void destroyInstance();
+
+    struct Request
+    {
+        QString source;
+        QSize size;
+        qreal devicePixelRatio;
+    };
+
+    QIcon placeholder(const QSize& size, qreal devicePixelRatio);
+    void finish(QFutureWatcher<QImage>* watcher);
+
+    QThreadPool m_pool;
+    QHash<QFutureWatcher<QImage>*, Request> m_pending;
+    QSet<QString> m_queued;  // cache keys being decoded
+    QSet<QString> m_failed;
+    QHash<QString, QIcon> m_placeholders;
+};
+
+#endif // ICONLOADER_H
@@ -0,0 +1,264 @@
+#include "modeladapter.h"
+#include "buttonbox.h"
+
+#include <QAbstractItemModel>
+#include <QToolButton>
+#include <QPixmap>
+
+ModelAdapter::ModelAdapter(ButtonBox* box) : QObject(box), m_box(box)
+{
+
+}
+
+void ModelAdapter::setModel(QAbstractItemModel* model)
+{
+    if (m_model == model)
+        return;
+
+    if (m_model)
+        disconnect(m_model.data(), 0, this, 0);
+
+    clear();
+    m_model = model;
+
+    if (m_model) {
+        connect(m_model.data(), SIGNAL(rowsInserted(QModelIndex,int,int)),
+                this, SLOT(onRowsInserted(QModelIndex,int,int)));
+        connect(m_model.data(), SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
+                this, SLOT(onRowsAboutToBeRemoved(QModelIndex,int,int)));
+        connect(m_model.data(), SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+                this, SLOT(onDataChanged(QModelIndex,QModelIndex)));
+
+        // Moves and re-sorts are rare for a catalog, just rebuild.
+        connect(m_model.data(), SIGNAL(modelReset()), this, SLOT(onModelReset()));
+        connect(m_model.data(), SIGNAL(layoutChanged()), this, SLOT(onModelReset()));
+        connect(m_model.data(), SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), this, SLOT(onModelReset()));
+
+        populate();
+    }
+}
+
+QAbstractItemModel* ModelAdapter::model() const
+{
+    return m_model;
+}
+
+void ModelAdapter::onRowsInserted(const QModelIndex& parent, int first, int last)
+{
+    if (parent.column() > 0)
+        return;
+
+    m_box->beginUpdate();
+    if (!parent.isValid())
+        insertCategories(first, last);
+    else if (!parent.parent().isValid())
+        insertRootButtons(parent.row(), first, last);
+    else if (!parent.parent().parent().isValid())
+        insertSubButtons(parent.parent().row(), parent.row(), first, last);
+    m_box->endUpdate();
+}
+
+void ModelAdapter::onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last)
+{
+    if (parent.column() > 0)
+        return;
+
+    m_box->beginUpdate();
+    if (!parent.isValid()) {
+        for (int row = last; row >= first; --row) {
+            const Category category = m_categories.takeAt(row);
+            foreach (const RootButton& root, category.roots)
+                forgetButtons(root);
+            m_box->removeCategory(category.title);
+        }
+    } else if (!parent.parent().isValid()) {
+        QList<RootButton>& roots = m_categories[parent.row()].roots;
+        for (int row = last; row >= first; --row) {
+            const RootButton root = roots.takeAt(row);
+            forgetButtons(root);
+            m_box->removeButton(root.button);
+        }
+    } else if (!parent.parent().parent().isValid()) {
+        QList<QToolButton*>& subButtons = m_categories[parent.parent().row()].roots[parent.row()].subButtons;
+        for (int row = last; row >= first; --row) {
+            QToolButton* subButton = subButtons.takeAt(row);
+            m_indexes.remove(subButton);
+            m_box->removeButton(subButton);
+        }
+    }
+    m_box->endUpdate();
+}
+
+void ModelAdapter::onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight)
+{
+    if (topLeft.column() > 0)
+        return;
+
+    const QModelIndex parent = topLeft.parent();
+    QSet<QString> titles;
+    if (!parent.isValid())
+        titles = boxTitles();
+
+    for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+        const QModelIndex index = m_model->index(row, 0, parent);
+        if (!parent.isValid()) {
+            Category& category = m_categories[row];
+            const QString title = uniqueTitle(categoryTitle(index), titles, category.title);
+            if (category.title != title) {
+                // title is free, so the rename holds while the box has the old one.
+                if (titles.contains(category.title)) {
+                    m_box->renameCategory(category.title, title);
+                    titles.remove(category.title);
+                    titles.insert(title);
+                    category.title = title;
+                }
+            }
+        } else if (!parent.parent().isValid()) {
+            QToolButton* button = m_categories.at(parent.row()).roots.at(row).button;
+            updateButton(button, index);
+            m_box->updateFilterIndex(button);
+        } else if (!parent.parent().parent().isValid()) {
+            QToolButton* subButton = m_categories.at(parent.parent().row()).roots.at(parent.row()).subButtons.at(row);
+            updateButton(subButton, index);
+            m_box->updateFilterIndex(subButton);
+        }
+    }
+}
+
+void ModelAdapter::onModelReset()
+{
+    clear();
+    populate();
+}
+
+void ModelAdapter::onButtonClicked()
+{
+    QToolButton* button = qobject_cast<QToolButton*>(sender());
+    emit itemTriggered(button->objectName());
+    emit indexTriggered(m_indexes.value(button));
+}
+
+void ModelAdapter::populate()
+{
+    if (!m_model)
+        return;
+
+    m_box->beginUpdate();
+    insertCategories(0, m_model->rowCount() - 1);
+    m_box->endUpdate();
+}
+
+void ModelAdapter::clear()
+{
+    m_box->beginUpdate();
+    foreach (const Category& category, m_categories)
+        m_box->removeCategory(category.title);
+    m_box->endUpdate();
+
+    m_categories.clear();
+    m_indexes.clear();
+}
+
+void ModelAdapter::insertCategories(int first, int last)
+{
+    // Read from the box once, then kept up to date by the pass.
+    QSet<QString> titles = boxTitles();
+    for (int row = first; row <= last; ++row) {
+        const QModelIndex index = m_model->index(row, 0);
+
+        Category category;
+        category.title = uniqueTitle(categoryTitle(index), titles);
+        titles.insert(category.title);
+        m_categories.insert(row, category);
+        m_box->insertCategory(row, category.title);
+
+        insertRootButtons(row, 0, m_model->rowCount(index) - 1);
+    }
+}
+
+void ModelAdapter::insertRootButtons(int category, int first, int last)
+{
+    const QModelIndex parent = m_model->index(category, 0);
+    for (int row = first; row <= last; ++row) {
+        const QModelIndex index = m_model->index(row, 0, parent);
+
+        RootButton root;
+        root.button = createButton(index);
+        m_categories[category].roots.insert(row, root);
+        m_box->insertButton(m_categories.at(category).title, row, root.button);
+
+        insertSubButtons(category, row, 0, m_model->rowCount(index) - 1);
+    }
+}
+
+void ModelAdapter::insertSubButtons(int category, int root, int first, int last)
+{
+    const QModelIndex parent = m_model->index(root, 0, m_model->index(category, 0));
+    for (int row = first; row <= last; ++row) {
+        const QModelIndex index = m_model->index(row, 0, parent);
+
+        QToolButton* subButton = createButton(index);
+        RootButton& rootButton = m_categories[category].roots[root];
+        rootButton.subButtons.insert(row, subButton);
+        m_box->insertSubButton(rootButton.button, row, subButton);
+    }
+}
+
+void ModelAdapter::forgetButtons(const RootButton& root)
+{
+    m_indexes.remove(root.button);
+    foreach (QToolButton* subButton, root.subButtons)
+        m_indexes.remove(subButton);
+}
+
+QToolButton* ModelAdapter::createButton(const QModelIndex& index)
+{
+    QToolButton* button = new QToolButton(m_box);
+    button->setIconSize(m_box->itemIconSize());
+    updateButton(button, index);
+    connect(button, SIGNAL(clicked()), this, SLOT(onButtonClicked()));
+
+    m_indexes.insert(button, index);
+    return button;
+}
+
+void ModelAdapter::updateButton(QToolButton* button, const QModelIndex& index) const
+{
+    const QString text = index.data(Qt::DisplayRole).toString();
+    const QString toolTip = index.data(Qt::ToolTipRole).toString();
+    const QVariant decoration = index.data(Qt::DecorationRole);
+
+    button->setObjectName(index.data(ButtonBox::IdRole).toString());
+    button->setText(text);
+    button->setToolTip(toolTip.isEmpty() ? text : toolTip);
+    if (decoration.type() == QVariant::Pixmap)
+        button->setIcon(QIcon(qvariant_cast<QPixmap>(decoration)));
+    else if (decoration.type() == QVariant::String)
+        m_box->setButtonIconSource(button, decoration.toString());
+    else
+        button->setIcon(qvariant_cast<QIcon>(decoration));
+    button->setEnabled(index.flags() & Qt::ItemIsEnabled);
+}
+
+QString ModelAdapter::categoryTitle(const QModelIndex& index) const
+{
+    return index.data(Qt::DisplayRole).toString();
+}
+
+QString ModelAdapter::uniqueTitle(const QString& text, const QSet<QString>& taken, const QString& current)
+{
+    QString title = text;
+    for (int n = 2; title != current && taken.contains(title); ++n)
+        title = QString("%1 (%2)").arg(text).arg(n);
+    return title;
+}
+
+QSet<QString> ModelAdapter::boxTitles() const
+{
+    const QStringList categories = m_box->categories();
+    QSet<QString> titles;
+    titles.reserve(categories.size());
+    foreach (const QString& title, categories)
+        titles.insert(title);
+    return titles;
+}
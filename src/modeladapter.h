@@ -0,0 +1,70 @@
+#ifndef MODELADAPTER_H
+#define MODELADAPTER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QPointer>
+#include <QPersistentModelIndex>
+
+class QAbstractItemModel;
+class QToolButton;
+class ButtonBox;
+
+// Mirrors a three level item model into a ButtonBox and keeps it in sync,
+// touching only the rows reported by the model's change signals.
+class ModelAdapter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ModelAdapter(ButtonBox* box);
+
+    void setModel(QAbstractItemModel* model);
+    QAbstractItemModel* model() const;
+
+signals:
+    void itemTriggered(const QString& id);
+    void indexTriggered(const QModelIndex& index);
+
+private slots:
+    void onRowsInserted(const QModelIndex& parent, int first, int last);
+    void onRowsAboutToBeRemoved(const QModelIndex& parent, int first, int last);
+    void onDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight);
+    void onModelReset();
+    void onButtonClicked();
+
+private:
+    struct RootButton
+    {
+        QToolButton* button;
+        QList<QToolButton*> subButtons;
+    };
+
+    // By row. The title is the one used in the box, unique there.
+    struct Category
+    {
+        QString title;
+        QList<RootButton> roots;
+    };
+
+    void populate();
+    void clear();
+    void insertCategories(int first, int last);
+    void insertRootButtons(int category, int first, int last);
+    void insertSubButtons(int category, int root, int first, int last);
+    void forgetButtons(const RootButton& root);
+
+    QToolButton* createButton(const QModelIndex& index);
+    void updateButton(QToolButton* button, const QModelIndex& index) const;
+    QString categoryTitle(const QModelIndex& index) const;
+    // text, or text with a number when another of the taken titles has it.
+    static QString uniqueTitle(const QString& text, const QSet<QString>& taken, const QString& current = QString());
+    QSet<QString> boxTitles() const;
+
+    ButtonBox* m_box;
+    QPointer<QAbstractItemModel> m_model;
+    QList<Category> m_categories;
+    QHash<QToolButton*, QPersistentModelIndex> m_indexes;
+};
+
+#endif // MODELADAPTER_H
@@ -0,0 +1,57 @@
+#include "offsetindex.h"
+
+void OffsetIndex::reset(const QVector<int>& extents)
+{
+    m_extents = extents;
+    m_tree.fill(0, extents.size() + 1);
+
+    // Linear build: every node passes its sum on to its parent.
+    for (int i = 1; i <= extents.size(); ++i) {
+        m_tree[i] += extents.at(i - 1);
+        const int parent = i + (i & -i);
+        if (parent <= extents.size())
+            m_tree[parent] += m_tree.at(i);
+    }
+}
+
+void OffsetIndex::setExtent(int index, int extent)
+{
+    const qint64 delta = qint64(extent) - m_extents.at(index);
+    if (delta == 0)
+        return;
+
+    m_extents[index] = extent;
+    for (int i = index + 1; i < m_tree.size(); i += i & -i)
+        m_tree[i] += delta;
+}
+
+qint64 OffsetIndex::offset(int index) const
+{
+    qint64 sum = 0;
+    for (int i = index; i > 0; i -= i & -i)
+        sum += m_tree.at(i);
+    return sum;
+}
+
+int OffsetIndex::indexAt(qint64 position) const
+{
+    if (position < 0)
+        return -1;
+
+    // Descend from the highest power of two, keeping the partial sums that
+    // stay at or below position; the entry after them covers it.
+    int step = 1;
+    while (step * 2 <= m_extents.size())
+        step *= 2;
+
+    int index = 0;
+    qint64 remaining = position;
+    for (; step > 0; step /= 2) {
+        if (index + step <= m_extents.size() && m_tree.at(index + step) <= remaining) {
+            index += step;
+            remaining -= m_tree.at(index);
+        }
+    }
+
+    return index < m_extents.size() ? index : -1;
+}
@@ -0,0 +1,32 @@
+#ifndef OFFSETINDEX_H
+#define OFFSETINDEX_H
+
+#include <QVector>
+
+// Fenwick tree over a sequence of extents, giving the offset of an entry,
+// the total and the entry at an offset in O(log n), and taking a change of
+// one extent in O(log n). Extents must not be negative.
+class OffsetIndex
+{
+public:
+    // Replaces the whole sequence, in O(n).
+    void reset(const QVector<int>& extents);
+    void clear() { reset(QVector<int>()); }
+
+    int count() const { return m_extents.size(); }
+    int extent(int index) const { return m_extents.at(index); }
+    void setExtent(int index, int extent);
+
+    // Sum of the extents before index.
+    qint64 offset(int index) const;
+    qint64 total() const { return offset(m_extents.size()); }
+
+    // The entry covering position, -1 when it is before 0 or past the end.
+    int indexAt(qint64 position) const;
+
+private:
+    QVector<int> m_extents;
+    QVector<qint64> m_tree; // 1-based partial sums
+};
+
+#endif // OFFSETINDEX_H
@@ -0,0 +1,174 @@
+#include "paletteloader.h"
+#include "buttonbox.h"
+#include "tracerecorder.h"
+
+#include <QFile>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Bytes handed to the parser at a time.
+static const qint64 ChunkSize = 64 * 1024;
+
+PaletteLoader::PaletteLoader(ButtonBox* box) : QObject(box),
+    m_box(box)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(0);
+    connect(m_timer, SIGNAL(timeout()), this, SLOT(parseSlice()));
+}
+
+PaletteLoader::~PaletteLoader()
+{
+    cancel();
+}
+
+bool PaletteLoader::load(const QString& fileName)
+{
+    cancel();
+
+    QFile* file = new QFile(fileName);
+    if (!file->open(QIODevice::ReadOnly)) {
+        m_errorString = file->errorString();
+        delete file;
+        return false;
+    }
+
+    m_device = file;
+    m_ownsDevice = true;
+    start();
+    return true;
+}
+
+void PaletteLoader::load(QIODevice* device)
+{
+    cancel();
+
+    m_device = device;
+    m_ownsDevice = false;
+    start();
+}
+
+bool PaletteLoader::isLoading() const
+{
+    return m_device != nullptr;
+}
+
+void PaletteLoader::cancel()
+{
+    m_timer->stop();
+    if (m_ownsDevice)
+        delete m_device;
+    m_device = nullptr;
+    m_ownsDevice = false;
+}
+
+void PaletteLoader::start()
+{
+    m_reader.clear();
+    m_category.clear();
+    m_buttonPath.clear();
+    m_errorString.clear();
+    m_timer->start();
+}
+
+void PaletteLoader::finish(bool ok)
+{
+    if (!ok && m_errorString.isEmpty())
+        m_errorString = QString("line %1: %2").arg(m_reader.lineNumber()).arg(m_reader.errorString());
+
+    cancel();
+    emit finished(ok);
+}
+
+bool PaletteLoader::readNextChunk()
+{
+    const QByteArray chunk = m_device->read(ChunkSize);
+    if (chunk.isEmpty())
+        return false;
+
+    m_reader.addData(chunk);
+    return true;
+}
+
+void PaletteLoader::parseSlice()
+{
+    if (!m_device)
+        return;
+
+    TraceScope trace("PaletteLoader::parseSlice");
+    QElapsedTimer timer;
+    timer.start();
+
+    // At least one token per pass, so a zero budget still makes progress.
+    bool done = false;
+    m_box->beginUpdate();
+    do {
+        const QXmlStreamReader::TokenType token = m_reader.readNext();
+
+        if (token == QXmlStreamReader::Invalid) {
+            // Out of data mid document: feed the next chunk, unless none is left.
+            if (m_reader.error() != QXmlStreamReader::PrematureEndOfDocumentError || !readNextChunk())
+                done = true;
+        } else if (token == QXmlStreamReader::StartElement) {
+            handleStartElement();
+        } else if (token == QXmlStreamReader::EndElement) {
+            if (m_reader.name() == QLatin1String("button") && !m_buttonPath.isEmpty())
+                m_buttonPath.removeLast();
+            else if (m_reader.name() == QLatin1String("category"))
+                m_category.clear();
+        } else if (token == QXmlStreamReader::EndDocument) {
+            done = true;
+        }
+
+        if (m_reader.hasError() && m_reader.error() != QXmlStreamReader::PrematureEndOfDocumentError)
+            done = true;
+    } while (!done && timer.elapsed() < m_box->populationBudget());
+    m_box->endUpdate();
+
+    emit progress(m_device->pos(), m_device->size());
+
+    if (!done) {
+        m_timer->start();
+        return;
+    }
+
+    finish(!m_reader.hasError() && m_errorString.isEmpty());
+}
+
+void PaletteLoader::handleStartElement()
+{
+    const QStringRef name = m_reader.name();
+    const QXmlStreamAttributes attributes = m_reader.attributes();
+
+    if (name == QLatin1String("category")) {
+        m_category = attributes.value("title").toString();
+        // Empty categories show as well, in the widget view.
+        if (m_box->viewMode() == ButtonBox::WidgetView)
+            m_box->insertCategory(-1, m_category);
+    } else if (name == QLatin1String("button")) {
+        if (m_category.isEmpty()) {
+            m_reader.raiseError(tr("button outside of a category"));
+            return;
+        }
+
+        ButtonBoxItem item;
+        item.id = attributes.value("id").toString();
+        if (item.id.isEmpty())
+            item.id = QString("palette-%1").arg(++m_serial);
+        item.text = attributes.value("text").toString();
+        item.toolTip = attributes.value("toolTip").toString();
+        item.iconSource = attributes.value("icon").toString();
+        item.checkable = attributes.value("checkable") == QLatin1String("true");
+        item.checked = attributes.value("checked") == QLatin1String("true");
+
+        // Deeper levels have nowhere to go, they hang off the root button.
+        if (m_buttonPath.isEmpty())
+            m_box->addItem(m_category, item);
+        else
+            m_box->addSubItem(m_buttonPath.first(), item);
+        m_buttonPath.append(item.id);
+    } else if (name != QLatin1String("palette")) {
+        m_reader.raiseError(tr("unexpected element %1").arg(name.toString()));
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef PALETTELOADER_H
+#define PALETTELOADER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+#include <QXmlStreamReader>
+
+class QIODevice;
+class QTimer;
+class ButtonBox;
+
+// Streams a palette definition into a ButtonBox:
+//
+//   <palette>
+//     <category title="Filters">
+//       <button id="blur" text="Blur" toolTip="..." icon=":/blur.svg" checkable="true">
+//         <button id="blur-h" text="Horizontal"/>
+//       </button>
+//     </category>
+//   </palette>
+//
+// The file is read and parsed a slice per event loop pass, each slice
+// bounded by the box's population budget, and the parsed buttons are added
+// as they come, so the first categories show while the rest is still read.
+// Buttons without an id get a generated one.
+class PaletteLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PaletteLoader(ButtonBox* box);
+    ~PaletteLoader();
+
+    // Starts loading, false when the file cannot be opened. A load in
+    // progress is abandoned, what it added stays.
+    bool load(const QString& fileName);
+    // The device must be open and hold all its data, like a file or buffer.
+    // The loader does not take ownership.
+    void load(QIODevice* device);
+
+    bool isLoading() const;
+    void cancel();
+
+    QString errorString() const { return m_errorString; }
+
+signals:
+    void progress(qint64 bytesRead, qint64 bytesTotal);
+    void finished(bool ok);
+
+private slots:
+    void parseSlice();
+
+private:
+    void start();
+    void finish(bool ok);
+    bool readNextChunk();
+    void handleStartElement();
+
+    ButtonBox* m_box;
+    QIODevice* m_device = nullptr;
+    bool m_ownsDevice = false;
+    QTimer* m_timer;
+    QXmlStreamReader m_reader;
+
+    QString m_category;
+    QStringList m_buttonPath; // ids of the open button elements
+    int m_serial = 0;
+    QString m_errorString;
+};
+
+#endif // PALETTELOADER_H
@@ -0,0 +1,154 @@
+#include "prefixindex.h"
+
+#include <algorithm>
+
+void PrefixIndex::insert(int id, const QStringList& texts)
+{
+    remove(id);
+
+    Words entry;
+    entry.generation = ++m_generation;
+    foreach (const QString& text, texts)
+        entry.words += words(text);
+    entry.words.removeDuplicates();
+
+    foreach (const QString& word, entry.words) {
+        Entry e = { word, id, entry.generation };
+        m_entries.append(e);
+    }
+    m_words.insert(id, entry);
+}
+
+void PrefixIndex::remove(int id)
+{
+    auto iter = m_words.find(id);
+    if (iter != m_words.end()) {
+        // The entries stay until the next compaction, skipped as stale.
+        m_staleCount += iter->words.size();
+        m_words.erase(iter);
+    }
+}
+
+void PrefixIndex::clear()
+{
+    m_entries.clear();
+    m_words.clear();
+    m_sortedCount = 0;
+    m_staleCount = 0;
+}
+
+QVector<int> PrefixIndex::find(const QString& query) const
+{
+    QVector<int> ids;
+
+    const QStringList queryWords = words(query);
+    if (queryWords.isEmpty())
+        return ids;
+
+    ensureSorted();
+
+    // Scan the range of the longest word, it is the most selective one.
+    QString longest;
+    foreach (const QString& word, queryWords) {
+        if (word.size() > longest.size())
+            longest = word;
+    }
+
+    Entry key = { longest, 0, 0 };
+    auto iter = std::lower_bound(m_entries.constBegin(), m_entries.constEnd(), key);
+    for (; iter != m_entries.constEnd() && iter->word.startsWith(longest); ++iter) {
+        if (!isStale(*iter))
+            ids.append(iter->id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    if (queryWords.size() > 1)
+        return narrow(ids, query);
+    return ids;
+}
+
+QVector<int> PrefixIndex::narrow(const QVector<int>& ids, const QString& query) const
+{
+    const QStringList queryWords = words(query);
+
+    QVector<int> result;
+    result.reserve(ids.size());
+    foreach (int id, ids) {
+        auto iter = m_words.constFind(id);
+        if (iter != m_words.constEnd() && matches(iter->words, queryWords))
+            result.append(id);
+    }
+    return result;
+}
+
+bool PrefixIndex::matches(int id, const QString& query) const
+{
+    auto iter = m_words.constFind(id);
+    return iter != m_words.constEnd() && matches(iter->words, words(query));
+}
+
+QStringList PrefixIndex::words(const QString& text)
+{
+    QStringList result;
+
+    int start = -1;
+    for (int i = 0; i <= text.size(); ++i) {
+        const bool letterOrNumber = i < text.size() && text.at(i).isLetterOrNumber();
+        const bool camelHump = letterOrNumber && start != -1
+                && text.at(i).isUpper() && text.at(i - 1).isLower();
+
+        if (start != -1 && (!letterOrNumber || camelHump)) {
+            result.append(text.mid(start, i - start).toCaseFolded());
+            start = -1;
+        }
+        if (letterOrNumber && start == -1)
+            start = i;
+    }
+
+    return result;
+}
+
+bool PrefixIndex::matches(const QStringList& words, const QStringList& queryWords)
+{
+    foreach (const QString& queryWord, queryWords) {
+        bool found = false;
+        foreach (const QString& word, words) {
+            if (word.startsWith(queryWord)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+bool PrefixIndex::isStale(const Entry& entry) const
+{
+    auto iter = m_words.constFind(entry.id);
+    return iter == m_words.constEnd() || iter->generation != entry.generation;
+}
+
+void PrefixIndex::ensureSorted() const
+{
+    if (m_staleCount > m_entries.size() / 2) {
+        // Mostly removed entries, compact before merging.
+        m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(),
+                                       [this](const Entry& e) { return isStale(e); }),
+                        m_entries.end());
+        m_staleCount = 0;
+        m_sortedCount = 0;
+    }
+
+    if (m_sortedCount == m_entries.size())
+        return;
+
+    // Sort the appended tail and merge it into the sorted head.
+    const auto middle = m_entries.begin() + m_sortedCount;
+    std::sort(middle, m_entries.end());
+    std::inplace_merge(m_entries.begin(), middle, m_entries.end());
+    m_sortedCount = m_entries.size();
+}
@@ -0,0 +1,56 @@
+#ifndef PREFIXINDEX_H
+#define PREFIXINDEX_H
+
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+// Sorted word index over the texts of integer ids. A query matches an id
+// when each of its words is a prefix of one of the id's words, ignoring
+// case. Changes are appended and merged on the next query.
+class PrefixIndex
+{
+public:
+    void insert(int id, const QStringList& texts);
+    void remove(int id);
+    void clear();
+    bool contains(int id) const { return m_words.contains(id); }
+
+    // Matching ids, sorted.
+    QVector<int> find(const QString& query) const;
+    // The ids of a previous result that still match a longer query.
+    QVector<int> narrow(const QVector<int>& ids, const QString& query) const;
+    bool matches(int id, const QString& query) const;
+
+    // Case folded words of text, split at non alphanumerics and at
+    // lower to upper case transitions.
+    static QStringList words(const QString& text);
+
+private:
+    struct Entry
+    {
+        QString word;
+        int id;
+        quint32 generation;
+
+        bool operator<(const Entry& other) const { return word < other.word; }
+    };
+
+    struct Words
+    {
+        QStringList words;
+        quint32 generation;
+    };
+
+    static bool matches(const QStringList& words, const QStringList& queryWords);
+    bool isStale(const Entry& entry) const;
+    void ensureSorted() const;
+
+    mutable QVector<Entry> m_entries;
+    mutable int m_sortedCount = 0;
+    mutable int m_staleCount = 0;
+    QHash<int, Words> m_words;
+    quint32 m_generation = 0;
+};
+
+#endif // PREFIXINDEX_H
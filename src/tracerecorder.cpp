@@ -0,0 +1,103 @@
+#include "tracerecorder.h"
+
+#include <QCoreApplication>
+#include <QFile>
+
+bool TraceRecorder::s_enabled = false;
+
+TraceRecorder::TraceRecorder()
+{
+    m_clock.start();
+    setCapacity(64 * 1024);
+}
+
+TraceRecorder* TraceRecorder::instance()
+{
+    static TraceRecorder recorder;
+    return &recorder;
+}
+
+void TraceRecorder::setEnabled(bool enabled)
+{
+    s_enabled = enabled;
+}
+
+void TraceRecorder::setCapacity(int events)
+{
+    m_events.resize(qMax(1, events));
+    clear();
+}
+
+int TraceRecorder::capacity() const
+{
+    return m_events.size();
+}
+
+int TraceRecorder::count() const
+{
+    return m_count;
+}
+
+void TraceRecorder::clear()
+{
+    m_next = 0;
+    m_count = 0;
+}
+
+void TraceRecorder::record(const char* name, qint64 startNsecs, qint64 durationNsecs)
+{
+    Event& event = m_events[m_next];
+    event.name = name;
+    event.start = startNsecs;
+    event.duration = durationNsecs;
+
+    if (++m_next == m_events.size())
+        m_next = 0;
+    if (m_count < m_events.size())
+        ++m_count;
+}
+
+QByteArray TraceRecorder::toChromeTrace() const
+{
+    // Complete ("X") events, timestamps in microseconds. Nesting is
+    // reconstructed by the viewer from the overlapping ranges.
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+
+    QByteArray json;
+    json.reserve(m_count * 96 + 64);
+    json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    const int first = m_count < m_events.size() ? 0 : m_next;
+    for (int i = 0; i < m_count; ++i) {
+        const Event& event = m_events.at((first + i) % m_events.size());
+        if (i > 0)
+            json += ',';
+        json += "\n{\"name\":\"";
+        json += event.name;
+        json += "\",\"cat\":\"buttonbox\",\"ph\":\"X\",\"ts\":";
+        json += QByteArray::number(event.start / 1000.0, 'f', 3);
+        json += ",\"dur\":";
+        json += QByteArray::number(event.duration / 1000.0, 'f', 3);
+        json += ",\"pid\":";
+        json += pid;
+        json += ",\"tid\":1}";
+    }
+
+    json += "\n]}\n";
+    return json;
+}
+
+bool TraceRecorder::writeChromeTrace(QIODevice* device) const
+{
+    const QByteArray json = toChromeTrace();
+    return device->write(json) == json.size();
+}
+
+bool TraceRecorder::writeChromeTrace(const QString& fileName) const
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    return writeChromeTrace(&file);
+}
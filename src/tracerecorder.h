@@ -0,0 +1,79 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <QElapsedTimer>
+#include <QVector>
+#include <QByteArray>
+
+class QIODevice;
+
+// Fixed size ring buffer of timed ButtonBox phases (layout passes, geometry
+// updates, popup builds, polish), exportable as Chrome trace-event JSON.
+// Disabled by default; recording is a clock read and a store into
+// preallocated memory. Names must be string literals. GUI thread only.
+class TraceRecorder
+{
+public:
+    static TraceRecorder* instance();
+
+    static bool isEnabled() { return s_enabled; }
+    void setEnabled(bool enabled);
+
+    // Number of events kept, the oldest ones are overwritten.
+    void setCapacity(int events);
+    int capacity() const;
+    int count() const;
+    void clear();
+
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+    void record(const char* name, qint64 startNsecs, qint64 durationNsecs);
+
+    QByteArray toChromeTrace() const;
+    bool writeChromeTrace(QIODevice* device) const;
+    bool writeChromeTrace(const QString& fileName) const;
+
+private:
+    TraceRecorder();
+    Q_DISABLE_COPY(TraceRecorder)
+
+    struct Event
+    {
+        const char* name;
+        qint64 start;
+        qint64 duration;
+    };
+
+    static bool s_enabled;
+
+    QElapsedTimer m_clock;
+    QVector<Event> m_events;
+    int m_next = 0;
+    int m_count = 0;
+};
+
+// Records the lifetime of the scope as one event when tracing is enabled.
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : m_name(name)
+    {
+        if (TraceRecorder::isEnabled())
+            m_start = TraceRecorder::instance()->now();
+    }
+
+    ~TraceScope()
+    {
+        if (m_start >= 0 && TraceRecorder::isEnabled()) {
+            TraceRecorder* recorder = TraceRecorder::instance();
+            recorder->record(m_name, m_start, recorder->now() - m_start);
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(TraceScope)
+
+    const char* m_name;
+    qint64 m_start = -1;
+};
+
+#endif // TRACERECORDER_H
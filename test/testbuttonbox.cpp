@@ -4,20 +4,26 @@
 #include <buttonbox.h>
 
 #include <QToolButton>
+#include <QLineEdit>
 
 void populateCategoryButtons(ButtonBox* box, const QString& category)
 {
     for (int i = 0; i < 10; ++i) {
         QToolButton* btn = new QToolButton(box);
         btn->setIconSize(QSize(32, 32));
+        btn->setText(QString("%1 %2").arg(category).arg(i));
 
         box->addButton(category, btn);
 
-        for (int j = 0; j < 5; ++j) {
-            QToolButton* subBtn = new QToolButton(box);
-            box->addSubButton(btn, subBtn);
-            subBtn->setIconSize(QSize(32, 32));
-        }
+        box->setSubButtonProvider(btn, [](QToolButton*) {
+            QList<QToolButton*> subButtons;
+            for (int j = 0; j < 5; ++j) {
+                QToolButton* subBtn = new QToolButton;
+                subBtn->setIconSize(QSize(32, 32));
+                subButtons.append(subBtn);
+            }
+            return subButtons;
+        });
     }
 }
 
@@ -26,13 +32,27 @@ TestButtonBox::TestButtonBox(QWidget *parent) :
     m_ui(new Ui::TestButtonBox)
 {
     m_ui->setupUi(this);
+    QLineEdit* filter = new QLineEdit(this);
+    filter->setPlaceholderText("Filter");
+    filter->setClearButtonEnabled(true);
+    m_ui->mainLayout->addWidget(filter);
+
+    QLineEdit* search = new QLineEdit(this);
+    search->setPlaceholderText("Search");
+    search->setClearButtonEnabled(true);
+    m_ui->mainLayout->addWidget(search);
+
     ButtonBox* bb = new ButtonBox(this);
     m_ui->mainLayout->addWidget(bb);
+    connect(filter, SIGNAL(textChanged(QString)), bb, SLOT(setFilterText(QString)));
+    connect(search, SIGNAL(textChanged(QString)), bb, SLOT(setSearchText(QString)));
 
+    bb->beginUpdate();
     populateCategoryButtons(bb, "Layouts");
     populateCategoryButtons(bb, "Items");
     populateCategoryButtons(bb, "Algorithms");
     populateCategoryButtons(bb, "Filters");
+    bb->endUpdate();
     bb->expandAll();
 
     setMaximumWidth(300);